@@ -0,0 +1,200 @@
+/*
+ * Idle memory compression benchmark.
+ *
+ * Loads the images, runs the guest until it waits for a key ( or halts, or runs out of
+ * instructions ), then compresses memory the way lc3 --compress-idle does and wakes it
+ * again : first the page at PC through mem_read(), like the guest does when a key arrives,
+ * then every other page. Each round checks memory came back unchanged.
+ *
+ * Reported : the 128 KiB guest memory against what compression keeps ( coded data plus
+ * the per page table ), the resulting sessions per GiB of guest memory, compression time
+ * and wake latency ( first page, all pages ) as median and worst over the rounds.
+ *
+ * Without image files the guest is generated here ( "table" ) : code at x3000 fills a
+ * table of TABLE_WORDS squares at x4000 ( n * n by adding odd numbers, so neither runs
+ * nor evenly spaced words ), then waits in GETC. The code is its own baseline image.
+ *
+ * compress-bench [--rounds=N] [--output=FILE] [image-file...]
+ *
+ * build : cc -O2 -fcommon -o compress-bench bench/compress-bench.c instruction-set.c execute.c fuzz.c hot-trace.c hle.c core/[a-z]*.c -lm -lpthread -lrt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "../core/core.h"
+#include "../core/keyboard.h"
+#include "../core/image-cache.h"
+#include "../core/compress.h"
+#include "../execute.h"
+
+enum { 
+    DEFAULT_ROUNDS   = 100,
+    MAX_INSTRUCTIONS = 10000000,   // guests that never ask for input stop here
+    TABLE_BYTES      = PAGE_COUNT * 16, // kind, size and pointer per guest page
+    GUEST_ORIGIN     = 0x3000,
+    TABLE_ORIGIN     = 0x4000,
+    TABLE_WORDS      = 4096,
+}; 
+
+/*
+ *         LD   R1, base      LD   R2, count     AND  R3, R3, #0    AND  R4, R4, #0    ADD R4, R4, #1
+ * loop :  STR  R3, R1, #0    ADD  R3, R3, R4    ADD  R4, R4, #2    ADD  R1, R1, #1
+ *         ADD  R2, R2, #-1   BRp  loop
+ * wait :  GETC               BRnzp wait
+ *         base, count
+ */
+static const uint16_t table_words[] = { 
+    0x220C,     // LD R1, base
+    0x240C,     // LD R2, count
+    0x56E0,     // AND R3, R3, #0
+    0x5920,     // AND R4, R4, #0
+    0x1921,     // ADD R4, R4, #1
+    0x7640,     // loop : STR R3, R1, #0
+    0x16C4,     // ADD R3, R3, R4
+    0x1922,     // ADD R4, R4, #2
+    0x1261,     // ADD R1, R1, #1
+    0x14BF,     // ADD R2, R2, #-1
+    0x03FA,     // BRp loop
+    0xF020,     // wait : GETC
+    0x0FFE,     // BRnzp wait
+    TABLE_ORIGIN,
+    TABLE_WORDS,
+}; 
+
+static const struct cached_image table_guest = { 
+    0, GUEST_ORIGIN, sizeof(table_words) / sizeof(table_words[0]), table_words,
+}; 
+
+static uint16_t snapshot[UINT16_MAX + 1]; 
+
+static uint64_t now_ns() { 
+    struct timespec now; 
+    clock_gettime(CLOCK_MONOTONIC, &now); 
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec; 
+}
+
+static int compare(const void* a, const void* b) { 
+    uint64_t x = *(const uint64_t*) a, y = *(const uint64_t*) b; 
+    return x < y ? -1 : x > y; 
+}
+
+// guest output would end up in the middle of the report
+static void run_guest() { 
+    static const uint8_t no_input[1]; 
+    fflush(stdout); 
+    int saved = dup(STDOUT_FILENO); 
+    int null = open("/dev/null", O_WRONLY); 
+    if(null >= 0) dup2(null, STDOUT_FILENO); 
+
+    keyboard_source = KB_BUFFER; 
+    keyboard_set_buffer(no_input, 0); 
+    registers[R_PC] = GUEST_ORIGIN; 
+    running = 1; 
+    while(running && instructions_retired < MAX_INSTRUCTIONS) fetchExecute(); 
+
+    fflush(stdout); 
+    if(saved >= 0) { 
+        dup2(saved, STDOUT_FILENO); 
+        close(saved); 
+    }
+    if(null >= 0) close(null); 
+}
+
+int main(int argc, const char* argv[]) { 
+    int rounds = DEFAULT_ROUNDS; 
+    FILE* output = stdout; 
+    int images = 0; 
+    for(int j = 1; j < argc; ++j) { 
+        if(strncmp(argv[j], "--rounds=", 9) == 0) { 
+            rounds = atoi(argv[j] + 9); 
+        }else if(strncmp(argv[j], "--output=", 9) == 0) { 
+            output = fopen(argv[j] + 9, "w"); 
+            if(!output) { 
+                perror(argv[j] + 9); 
+                return 1; 
+            }
+        }else if(argv[j][0] == '-') { 
+            printf("compress-bench [--rounds=N] [--output=FILE] [image-file...]\n"); 
+            return 2; 
+        }else { 
+            if(!image_cache_load(argv[j], memory)) { 
+                perror(argv[j]); 
+                return 1; 
+            }
+            compress_baseline(image_cache_acquire(argv[j])); 
+            ++images; 
+        }
+    }
+    if(!images) { 
+        memcpy(memory + table_guest.origin, table_guest.words, table_guest.length * sizeof(uint16_t)); 
+        compress_baseline(&table_guest); 
+    }
+    if(rounds < 1) rounds = 1; 
+
+    run_guest(); 
+    memcpy(snapshot, memory, sizeof(snapshot)); 
+    int used_pages = 0; 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        for(int i = 0; i < PAGE_SIZE; ++i) { 
+            if(snapshot[(page << PAGE_SHIFT) + i]) { 
+                ++used_pages; 
+                break; 
+            }
+        }
+    }
+
+    uint64_t* compress_ns = calloc(rounds, sizeof(uint64_t)); 
+    uint64_t* first_ns = calloc(rounds, sizeof(uint64_t)); 
+    uint64_t* all_ns = calloc(rounds, sizeof(uint64_t)); 
+    struct compress_stats compressed = { 0 }; 
+    int mismatches = 0; 
+    for(int round = 0; round < rounds; ++round) { 
+        uint64_t start = now_ns(); 
+        compress_memory(); 
+        compress_ns[round] = now_ns() - start; 
+        compressed = compress_stats; 
+
+        start = now_ns(); 
+        volatile uint16_t word = mem_read(registers[R_PC]); 
+        (void) word; 
+        first_ns[round] = now_ns() - start; 
+        start = now_ns(); 
+        compress_wake_all(); 
+        all_ns[round] = now_ns() - start + first_ns[round]; 
+
+        mismatches += memcmp(snapshot, memory, sizeof(snapshot)) != 0; 
+    }
+    qsort(compress_ns, rounds, sizeof(uint64_t), compare); 
+    qsort(first_ns, rounds, sizeof(uint64_t), compare); 
+    qsort(all_ns, rounds, sizeof(uint64_t), compare); 
+
+    // pages left as they are ( devices, incompressible ) still count in full
+    double kept = (double) compressed.stored_bytes + TABLE_BYTES
+        + (double) (PAGE_COUNT - compressed.compressed_pages) * PAGE_SIZE * sizeof(uint16_t); 
+    double full = sizeof(uint16_t) * (UINT16_MAX + 1); 
+    fprintf(output, "{\n  \"guest\": \"%s\",\n  \"images\": %d,\n  \"rounds\": %d,\n  \"instructions\": %llu,\n  \"waiting_for_input\": %s,\n",
+            images ? "images" : "table", images, rounds, (unsigned long long) instructions_retired, halted || instructions_retired >= MAX_INSTRUCTIONS ? "false" : "true"); 
+    fprintf(output, "  \"used_pages\": %d,\n  \"compressed_pages\": %llu,\n  \"zero_pages\": %llu,\n  \"image_pages\": %llu,\n",
+            used_pages, (unsigned long long) compressed.compressed_pages,
+            (unsigned long long) compressed.zero_pages, (unsigned long long) compressed.image_pages); 
+    fprintf(output, "  \"memory_bytes\": %.0f,\n  \"kept_bytes\": %.0f,\n  \"released_bytes\": %llu,\n  \"ratio\": %.1f,\n",
+            full, kept, (unsigned long long) compressed.released_bytes, full / kept); 
+    fprintf(output, "  \"sessions_per_gib\": { \"plain\": %.0f, \"compressed\": %.0f },\n", (1 << 30) / full, (1 << 30) / kept); 
+    fprintf(output, "  \"compress_ns\": { \"median\": %llu, \"max\": %llu },\n",
+            (unsigned long long) compress_ns[rounds / 2], (unsigned long long) compress_ns[rounds - 1]); 
+    fprintf(output, "  \"wake_first_page_ns\": { \"median\": %llu, \"max\": %llu },\n",
+            (unsigned long long) first_ns[rounds / 2], (unsigned long long) first_ns[rounds - 1]); 
+    fprintf(output, "  \"wake_all_ns\": { \"median\": %llu, \"max\": %llu },\n",
+            (unsigned long long) all_ns[rounds / 2], (unsigned long long) all_ns[rounds - 1]); 
+    fprintf(output, "  \"mismatches\": %d\n}\n", mismatches); 
+    if(output != stdout) fclose(output); 
+    free(compress_ns); 
+    free(first_ns); 
+    free(all_ns); 
+    return mismatches ? 1 : 0; 
+}
@@ -0,0 +1,273 @@
+/*
+ * Hot trace benchmark : the same numeric loops run by the plain interpreter loop
+ * ( "interpreter", while(running) fetchExecute() ) and by hot_run() ( "hot-traces" ).
+ *
+ *  sum   LDR / ADD over a 256 word array
+ *  fib   register only ADD chain
+ *  copy  LDR / STR word copy, 256 words
+ *  mul   shift and add multiply, the data dependent BRz makes guards fail half the time
+ *
+ * Every case has its code on its own page, traces and heat counts of one case never
+ * apply to another. A pass runs each program RUNS times in both modes, the best pass is
+ * reported in nanoseconds per retired guest instruction. Both modes must end with the
+ * same registers ( "same_result" ). HALT prints, the console goes to /dev/null meanwhile.
+ *
+ * hot-trace-bench [--passes=N] [--only=NAME] [--output=FILE]
+ *
+ * build : cc -O2 -fcommon -o hot-trace-bench bench/hot-trace-bench.c instruction-set.c execute.c fuzz.c hot-trace.c hle.c core/[a-z]*.c -lm -lpthread -lrt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "../core/core.h"
+#include "../execute.h"
+#include "../hot-trace.h"
+
+enum { 
+    DEFAULT_PASSES = 5,
+    RUNS           = 8,
+    CODE_ORIGIN    = 0x3000,     // case i at CODE_ORIGIN + i * 0x100
+    ARRAY          = 0x4000,
+    COPY_TARGET    = 0x5000,
+    ARRAY_LENGTH   = 256,
+}; 
+
+enum { 
+    MODE_INTERPRETER = 0,
+    MODE_HOT,
+    MODE_COUNT,
+}; 
+
+static const char* mode_names[MODE_COUNT] = { "interpreter", "hot-traces" }; 
+
+// the program being generated and where its words go
+static uint16_t program[64]; 
+static int at; 
+
+static int emit(uint16_t word) { 
+    program[at] = word; 
+    return at++; 
+}
+
+// PC relative 9 bit offset from the instruction at index from to index to
+static uint16_t offset9(int from, int to) { 
+    return (uint16_t) (to - (from + 1)) & 0x1FF; 
+}
+
+static uint16_t add_register(int dr, int sr1, int sr2) { return 0x1000 | dr << 9 | sr1 << 6 | sr2; }
+static uint16_t add_immediate(int dr, int sr, int imm) { return 0x1000 | dr << 9 | sr << 6 | 0x20 | (imm & 0x1F); }
+static uint16_t and_register(int dr, int sr1, int sr2) { return 0x5000 | dr << 9 | sr1 << 6 | sr2; }
+static uint16_t and_immediate(int dr, int sr, int imm) { return 0x5000 | dr << 9 | sr << 6 | 0x20 | (imm & 0x1F); }
+static uint16_t ldr(int dr, int base, int offset) { return 0x6000 | dr << 9 | base << 6 | (offset & 0x3F); }
+static uint16_t str(int sr, int base, int offset) { return 0x7000 | sr << 9 | base << 6 | (offset & 0x3F); }
+
+enum { N = 4, Z = 2, P = 1 }; 
+
+// LD / BR with the offset filled in once the target is known
+static int ld_at(int dr) { return emit(0x2000 | dr << 9); }
+static void patch(int instruction, int target) { program[instruction] |= offset9(instruction, target); }
+static void branch(int flags, int target) { int i = emit(flags << 9); patch(i, target); }
+
+static void generate_sum() { 
+    int outer_count = ld_at(4); 
+    int outer = ld_at(1); 
+    int count = ld_at(2); 
+    int inner = emit(ldr(3, 1, 0)); 
+    emit(add_register(0, 0, 3)); 
+    emit(add_immediate(1, 1, 1)); 
+    emit(add_immediate(2, 2, -1)); 
+    branch(P, inner); 
+    emit(add_immediate(4, 4, -1)); 
+    branch(P, outer); 
+    emit(0xF025); 
+    patch(outer_count, emit(2000)); 
+    patch(outer, emit(ARRAY)); 
+    patch(count, emit(ARRAY_LENGTH)); 
+}
+
+static void generate_fib() { 
+    int outer_count = ld_at(4); 
+    int outer = ld_at(3); 
+    emit(and_immediate(0, 0, 0)); 
+    emit(add_immediate(1, 0, 1)); 
+    int inner = emit(add_register(2, 0, 1)); 
+    emit(add_immediate(0, 1, 0)); 
+    emit(add_immediate(1, 2, 0)); 
+    emit(add_immediate(3, 3, -1)); 
+    branch(P, inner); 
+    emit(add_immediate(4, 4, -1)); 
+    branch(P, outer); 
+    emit(0xF025); 
+    patch(outer_count, emit(2000)); 
+    patch(outer, emit(ARRAY_LENGTH)); 
+}
+
+static void generate_copy() { 
+    int outer_count = ld_at(4); 
+    int outer = ld_at(1); 
+    int target = ld_at(2); 
+    int count = ld_at(3); 
+    int inner = emit(ldr(5, 1, 0)); 
+    emit(str(5, 2, 0)); 
+    emit(add_immediate(1, 1, 1)); 
+    emit(add_immediate(2, 2, 1)); 
+    emit(add_immediate(3, 3, -1)); 
+    branch(P, inner); 
+    emit(add_immediate(4, 4, -1)); 
+    branch(P, outer); 
+    emit(0xF025); 
+    patch(outer_count, emit(1600)); 
+    patch(outer, emit(ARRAY)); 
+    patch(target, emit(COPY_TARGET)); 
+    patch(count, emit(ARRAY_LENGTH)); 
+}
+
+// R0 = R1 * R2 for R1 = the outer counter, the loop of hle.c's mul routine
+static void generate_mul() { 
+    int outer_count = ld_at(6); 
+    int outer = emit(add_immediate(1, 6, 0)); 
+    int multiplier = ld_at(2); 
+    emit(and_immediate(0, 0, 0)); 
+    emit(add_immediate(4, 1, 0)); 
+    emit(and_immediate(5, 5, 0)); 
+    emit(add_immediate(5, 5, 1)); 
+    int loop = emit(and_register(3, 2, 5)); 
+    int skip_branch = emit(Z << 9); 
+    emit(add_register(0, 0, 4)); 
+    int skip = emit(add_register(4, 4, 4)); 
+    patch(skip_branch, skip); 
+    emit(add_register(5, 5, 5)); 
+    branch(N | P, loop); 
+    emit(add_immediate(6, 6, -1)); 
+    branch(P, outer); 
+    emit(0xF025); 
+    patch(outer_count, emit(30000)); 
+    patch(multiplier, emit(0x5A93)); 
+}
+
+struct bench_case { 
+    const char* name; 
+    void (*generate)(); 
+}; 
+
+static const struct bench_case cases[] = { 
+    { "sum",  generate_sum },
+    { "fib",  generate_fib },
+    { "copy", generate_copy },
+    { "mul",  generate_mul },
+}; 
+
+enum { CASE_COUNT = sizeof(cases) / sizeof(cases[0]) }; 
+
+static uint64_t now_ns() { 
+    struct timespec now; 
+    clock_gettime(CLOCK_MONOTONIC, &now); 
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec; 
+}
+
+// HALT prints : console output goes to /dev/null while a program runs
+static int console_to_null(int saved) { 
+    fflush(stdout); 
+    if(saved < 0) { 
+        int null = open("/dev/null", O_WRONLY); 
+        saved = dup(STDOUT_FILENO); 
+        dup2(null, STDOUT_FILENO); 
+        close(null); 
+        return saved; 
+    }
+    dup2(saved, STDOUT_FILENO); 
+    close(saved); 
+    return -1; 
+}
+
+// RUNS runs of the program at origin, ns per retired instruction, the registers it ended with
+static double run(int mode, uint16_t origin, uint16_t result[R_COUNT]) { 
+    uint64_t retired = instructions_retired; 
+    uint64_t start = now_ns(); 
+    for(int r = 0; r < RUNS; ++r) { 
+        memset(registers, 0, sizeof(registers)); 
+        registers[R_PC] = origin; 
+        registers[R_COND] = FL_ZRO; 
+        halted = 0; 
+        running = 1; 
+        if(mode == MODE_HOT) { 
+            hot_run(); 
+        }else { 
+            while(running) fetchExecute(); 
+        }
+    }
+    uint64_t elapsed = now_ns() - start; 
+    memcpy(result, registers, sizeof(registers)); 
+    return (double) elapsed / (instructions_retired - retired); 
+}
+
+static void measure(FILE* output, int index, int passes, int* first) { 
+    const struct bench_case* bench = &cases[index]; 
+    uint16_t origin = CODE_ORIGIN + index * 0x100; 
+    at = 0; 
+    bench->generate(); 
+    // through mem_write() : stale traces on these words would be dropped
+    for(int i = 0; i < at; ++i) mem_write(origin + i, program[i]); 
+
+    double best[MODE_COUNT] = { 0 }; 
+    uint16_t result[MODE_COUNT][R_COUNT]; 
+    uint64_t instructions = 0; 
+    int saved = console_to_null(-1); 
+    for(int pass = 0; pass < passes; ++pass) { 
+        for(int mode = 0; mode < MODE_COUNT; ++mode) { 
+            uint64_t retired = instructions_retired; 
+            double ns = run(mode, origin, result[mode]); 
+            instructions = (instructions_retired - retired) / RUNS; 
+            if(pass == 0 || ns < best[mode]) best[mode] = ns; 
+        }
+    }
+    console_to_null(saved); 
+
+    int same = memcmp(result[MODE_INTERPRETER], result[MODE_HOT], sizeof(result[0])) == 0; 
+    fprintf(output, "%s\n    { \"name\": \"%s\", \"instructions\": %llu", *first ? "" : ",", bench->name, (unsigned long long) instructions); 
+    for(int mode = 0; mode < MODE_COUNT; ++mode) fprintf(output, ", \"%s_ns\": %.3f", mode_names[mode], best[mode]); 
+    fprintf(output, ", \"speedup\": %.2f, \"same_result\": %s }", best[MODE_INTERPRETER] / best[MODE_HOT], same ? "true" : "false"); 
+    fflush(output); 
+    *first = 0; 
+}
+
+int main(int argc, const char* argv[]) { 
+    int passes = DEFAULT_PASSES; 
+    const char* only = NULL; 
+    FILE* output = stdout; 
+    for(int j = 1; j < argc; ++j) { 
+        if(strncmp(argv[j], "--passes=", 9) == 0) { 
+            passes = atoi(argv[j] + 9); 
+        }else if(strncmp(argv[j], "--only=", 7) == 0) { 
+            only = argv[j] + 7; 
+        }else if(strncmp(argv[j], "--output=", 9) == 0) { 
+            output = fopen(argv[j] + 9, "w"); 
+            if(!output) { 
+                perror(argv[j] + 9); 
+                return 1; 
+            }
+        }else { 
+            printf("hot-trace-bench [--passes=N] [--only=NAME] [--output=FILE]\n"); 
+            return 2; 
+        }
+    }
+    if(passes < 1) passes = 1; 
+
+    // ARRAY holds some numbers to add and copy
+    for(int i = 0; i < ARRAY_LENGTH; ++i) mem_write(ARRAY + i, (uint16_t) (i * 2654435761u >> 7)); 
+
+    fprintf(output, "{\n  \"passes\": %d,\n  \"runs\": %d,\n  \"results\": [", passes, RUNS); 
+    int first = 1; 
+    for(int i = 0; i < CASE_COUNT; ++i) { 
+        if(only && strcmp(only, cases[i].name) != 0) continue; 
+        measure(output, i, passes, &first); 
+    }
+    fprintf(output, "\n  ]\n}\n"); 
+    if(output != stdout) fclose(output); 
+    return 0; 
+}
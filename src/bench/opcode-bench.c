@@ -0,0 +1,341 @@
+/*
+ * Per opcode microbenchmark.
+ *
+ * Every handler of instruction-set.c runs over a synthetic stream of its own instructions,
+ * once called directly ( "handler" ) and once through fetchExecute() ( "dispatch", fetch +
+ * decode + switch + handler ). A "mix" stream of ALU, branch and load instructions
+ * only runs through dispatch, it shows the cost of the opcode switch when it cannot predict.
+ * The trap stream runs OUT and PUTS with the console sent to /dev/null.
+ *
+ * Instructions are laid out every STREAM_STRIDE words from STREAM_START, ST only gets even
+ * offsets and so stores between two instructions, every other load / store address is in
+ * the data region from DATA_START. No stream rewrites the code it runs.
+ *
+ * Counters come from perf_event_open ( cycles, instructions, branch misses, L1 data read
+ * misses, user space only ). When cycles cannot be opened the time is taken with rdtsc
+ * ( clock_gettime on other hosts ) and the other counters are reported as null.
+ * All values are per emulated instruction.
+ *
+ * opcode-bench [--passes=N] [--only=NAME] [--output=FILE]
+ *
+ * build : cc -O2 -fcommon -o opcode-bench bench/opcode-bench.c instruction-set.c execute.c fuzz.c hot-trace.c hle.c core/[a-z]*.c -lm -lpthread -lrt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "../core/core.h"
+#include "../core/opcodes.h"
+#include "../instruction-set.h"
+#include "../execute.h"
+
+enum { 
+    STREAM_LENGTH  = 1 << 13,   // instructions per pass
+    STREAM_START   = 0x3000,
+    STREAM_STRIDE  = 2,         // code x3000-x6FFE on even addresses
+    DATA_START     = 0x8000,    // data words and base registers point into x8000-xBFFF
+    PUTS_LENGTH    = 16,        // characters of the string R0 points to
+    DEFAULT_PASSES = 200,
+}; 
+
+enum { 
+    COUNTER_CYCLES = 0,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1D_MISSES,
+    COUNTER_COUNT,
+}; 
+
+static const char* counter_names[COUNTER_COUNT] = { 
+    "cycles", "instructions", "branch_misses", "l1d_misses",
+}; 
+
+static int counter_fd[COUNTER_COUNT] = { -1, -1, -1, -1 }; 
+
+// handler mode calls it directly, NULL = dispatch only
+typedef void (*handler)(uint16_t instruction); 
+
+struct bench_case { 
+    const char* name; 
+    handler run; 
+    uint16_t (*generate)(); 
+}; 
+
+static uint16_t stream[STREAM_LENGTH]; 
+
+// xorshift, every run sees the same streams
+static uint32_t random_state = 0x2545F491; 
+
+static uint32_t next_random() { 
+    random_state ^= random_state << 13; 
+    random_state ^= random_state >> 17; 
+    random_state ^= random_state << 5; 
+    return random_state; 
+}
+
+static uint16_t field(int bits) { 
+    return next_random() & ((1 << bits) - 1); 
+}
+
+/*
+ * Stream generators. Register values and memory contents are set up ( see reset_machine )
+ * so that every address a stream computes stays below the device page.
+ */
+static uint16_t generate_add() { 
+    return (OP_ADD << 12) | field(3) << 9 | field(3) << 6 | (field(1) ? 0x20 | field(5) : field(3)); 
+}
+
+static uint16_t generate_and() { 
+    return (OP_AND << 12) | field(3) << 9 | field(3) << 6 | (field(1) ? 0x20 | field(5) : field(3)); 
+}
+
+static uint16_t generate_not() { 
+    return (OP_NOT << 12) | field(3) << 9 | field(3) << 6 | 0x3F; 
+}
+
+// random condition codes : taken and not taken mixed
+static uint16_t generate_branch() { 
+    return (OP_BR << 12) | field(3) << 9 | field(9); 
+}
+
+static uint16_t generate_jump() { 
+    return (OP_JMP << 12) | field(3) << 6; 
+}
+
+static uint16_t generate_jsr() { 
+    return field(1) ? (OP_JSR << 12) | 0x800 | field(11) : (OP_JSR << 12) | field(3) << 6; 
+}
+
+static uint16_t generate_load() { 
+    return (OP_LD << 12) | field(3) << 9 | field(9); 
+}
+
+static uint16_t generate_load_indirect() { 
+    return (OP_LDI << 12) | field(3) << 9 | field(9); 
+}
+
+static uint16_t generate_load_register() { 
+    return (OP_LDR << 12) | field(3) << 9 | field(3) << 6 | field(6); 
+}
+
+static uint16_t generate_lea() { 
+    return (OP_LEA << 12) | field(3) << 9 | field(9); 
+}
+
+// even offsets : PC + 1 + offset is odd, between two instructions of the stream
+static uint16_t generate_store() { 
+    return (OP_ST << 12) | field(3) << 9 | field(8) << 1; 
+}
+
+static uint16_t generate_store_indirect() { 
+    return (OP_STI << 12) | field(3) << 9 | field(9); 
+}
+
+static uint16_t generate_store_register() { 
+    return (OP_STR << 12) | field(3) << 9 | field(3) << 6 | field(6); 
+}
+
+// GETC / IN would wait for a key and HALT stop the machine
+static uint16_t generate_trap() { 
+    return (OP_TRAP << 12) | (field(1) ? TRAP_OUT : TRAP_PUTS); 
+}
+
+// only PC relative loads : ALU results may hold any value and a store could land on a later instruction
+static uint16_t generate_mix() { 
+    static uint16_t (*const parts[])() = { 
+        generate_add, generate_and, generate_not, generate_branch,
+        generate_load, generate_lea, 
+    }; 
+    return parts[next_random() % (sizeof(parts) / sizeof(parts[0]))](); 
+}
+
+static const struct bench_case cases[] = { 
+    { "add",                  add,                  generate_add },
+    { "and",                  and,                  generate_and },
+    { "not",                  not,                  generate_not },
+    { "branch",               branch,               generate_branch },
+    { "jump",                 jump,                 generate_jump },
+    { "jumpToSubroutine",     jumpToSubroutine,     generate_jsr },
+    { "load",                 load,                 generate_load },
+    { "loadIndirect",         loadIndirect,         generate_load_indirect },
+    { "loadRegister",         loadRegister,         generate_load_register },
+    { "loadEffectiveAddress", loadEffectiveAddress, generate_lea },
+    { "store",                store,                generate_store },
+    { "storeIndirect",        storeIndirect,        generate_store_indirect },
+    { "storeRegister",        storeRegister,        generate_store_register },
+    { "trap",                 trap,                 generate_trap },
+    { "mix",                  NULL,                 generate_mix },
+}; 
+
+/*
+ * Data words point into x8000-xBFFF and registers start there too, so LDI / STI / LDR / STR
+ * addresses ( pointer + 6 bit offset ) stay clear of the code and the device page. Pointers
+ * read from code words ( xA... LDI, xB... STI ) land in the data region as well.
+ */
+static void reset_machine() { 
+    for(uint32_t address = 0; address < MR_KBSR; ++address) { 
+        memory[address] = DATA_START | (address & 0x3FFF); 
+    }
+    for(int r = R_R0; r <= R_R7; ++r) { 
+        registers[r] = DATA_START + r * 0x100; 
+    }
+    // the string PUTS prints from R0
+    memory[DATA_START + PUTS_LENGTH] = 0; 
+    registers[R_PC] = STREAM_START; 
+    registers[R_COND] = FL_ZRO; 
+}
+
+static long perf_event_open(struct perf_event_attr* attributes) { 
+    return syscall(__NR_perf_event_open, attributes, 0, -1, -1, 0); 
+}
+
+static void open_counters() { 
+    static const struct { uint32_t type; uint64_t config; } events[COUNTER_COUNT] = { 
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+    }; 
+    for(int i = 0; i < COUNTER_COUNT; ++i) { 
+        struct perf_event_attr attributes; 
+        memset(&attributes, 0, sizeof(attributes)); 
+        attributes.size = sizeof(attributes); 
+        attributes.type = events[i].type; 
+        attributes.config = events[i].config; 
+        attributes.exclude_kernel = 1; 
+        attributes.exclude_hv = 1; 
+        counter_fd[i] = perf_event_open(&attributes); 
+    }
+}
+
+static uint64_t timestamp() { 
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc(); 
+#else
+    struct timespec now; 
+    clock_gettime(CLOCK_MONOTONIC, &now); 
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec; 
+#endif
+}
+
+// current value of every counter, the cycle slot falls back to the timestamp
+static void sample(uint64_t values[COUNTER_COUNT]) { 
+    for(int i = 0; i < COUNTER_COUNT; ++i) { 
+        values[i] = 0; 
+        if(counter_fd[i] >= 0 && read(counter_fd[i], &values[i], sizeof(values[i])) != sizeof(values[i])) values[i] = 0; 
+    }
+    if(counter_fd[COUNTER_CYCLES] < 0) values[COUNTER_CYCLES] = timestamp(); 
+}
+
+static void run_handler(handler run) { 
+    for(int i = 0; i < STREAM_LENGTH; ++i) { 
+        run(stream[i]); 
+    }
+}
+
+// PC is set before each fetch so jumps and branches cannot leave the stream
+static void run_dispatch() { 
+    for(int i = 0; i < STREAM_LENGTH; ++i) { 
+        registers[R_PC] = STREAM_START + i * STREAM_STRIDE; 
+        fetchExecute(); 
+    }
+}
+
+// traps print : console output goes to /dev/null while a stream runs
+static void console(int restore) { 
+    static int saved = -1; 
+    fflush(stdout); 
+    if(!restore) { 
+        int null = open("/dev/null", O_WRONLY); 
+        if(null < 0) return; 
+        saved = dup(STDOUT_FILENO); 
+        dup2(null, STDOUT_FILENO); 
+        close(null); 
+    }else if(saved >= 0) { 
+        dup2(saved, STDOUT_FILENO); 
+        close(saved); 
+        saved = -1; 
+    }
+}
+
+static void measure(FILE* output, const struct bench_case* bench, int dispatch, int passes, int* first) { 
+    uint64_t totals[COUNTER_COUNT] = { 0 }; 
+    console(0); 
+    for(int pass = -1; pass < passes; ++pass) { 
+        // stores may have overwritten the stream, pass -1 warms up
+        reset_machine(); 
+        for(int i = 0; i < STREAM_LENGTH; ++i) memory[STREAM_START + i * STREAM_STRIDE] = stream[i]; 
+        uint64_t before[COUNTER_COUNT], after[COUNTER_COUNT]; 
+        sample(before); 
+        if(dispatch) run_dispatch(); 
+        else run_handler(bench->run); 
+        sample(after); 
+        if(pass < 0) continue; 
+        for(int i = 0; i < COUNTER_COUNT; ++i) totals[i] += after[i] - before[i]; 
+    }
+
+    double executed = (double) passes * STREAM_LENGTH; 
+    console(1); 
+    fprintf(output, "%s\n    { \"name\": \"%s\", \"mode\": \"%s\"", *first ? "" : ",", bench->name, dispatch ? "dispatch" : "handler"); 
+    for(int i = 0; i < COUNTER_COUNT; ++i) { 
+        if(counter_fd[i] >= 0 || i == COUNTER_CYCLES) fprintf(output, ", \"%s\": %.3f", counter_names[i], totals[i] / executed); 
+        else fprintf(output, ", \"%s\": null", counter_names[i]); 
+    }
+    fprintf(output, " }"); 
+    *first = 0; 
+}
+
+int main(int argc, const char* argv[]) { 
+    int passes = DEFAULT_PASSES; 
+    const char* only = NULL; 
+    FILE* output = stdout; 
+    for(int j = 1; j < argc; ++j) { 
+        if(strncmp(argv[j], "--passes=", 9) == 0) { 
+            passes = atoi(argv[j] + 9); 
+        }else if(strncmp(argv[j], "--only=", 7) == 0) { 
+            only = argv[j] + 7; 
+        }else if(strncmp(argv[j], "--output=", 9) == 0) { 
+            output = fopen(argv[j] + 9, "w"); 
+            if(!output) { 
+                perror(argv[j] + 9); 
+                return 1; 
+            }
+        }else { 
+            printf("opcode-bench [--passes=N] [--only=NAME] [--output=FILE]\n"); 
+            return 2; 
+        }
+    }
+    if(passes < 1) passes = 1; 
+
+    open_counters(); 
+    const char* clock = counter_fd[COUNTER_CYCLES] >= 0 ? "perf" :
+#if defined(__x86_64__) || defined(__i386__)
+        "rdtsc"; 
+#else
+        "clock_gettime"; 
+#endif
+
+    fprintf(output, "{\n  \"stream_length\": %d,\n  \"passes\": %d,\n  \"clock\": \"%s\",\n  \"results\": [", STREAM_LENGTH, passes, clock); 
+    int first = 1; 
+    for(size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) { 
+        const struct bench_case* bench = &cases[c]; 
+        if(only && strcmp(only, bench->name) != 0) continue; 
+        for(int i = 0; i < STREAM_LENGTH; ++i) stream[i] = bench->generate(); 
+        if(bench->run) measure(output, bench, 0, passes, &first); 
+        measure(output, bench, 1, passes, &first); 
+    }
+    fprintf(output, "\n  ]\n}\n"); 
+    if(output != stdout) fclose(output); 
+    return 0; 
+}
@@ -0,0 +1,246 @@
+/*
+ * Sampler overhead benchmark.
+ *
+ * A generated loop ( LDR / ADD over an array with a JSR per element, so PC and R7 both move )
+ * runs through the plain fetchExecute() loop in a child process, once without the sampler
+ * and once with sampler_open() at HZ, alternating for PASSES passes. Each child reports
+ * the CPU time of the interpreter thread ( where SIGPROF is handled ) and of the whole
+ * process ( the aggregation thread included ) per retired guest instruction. Reported : the
+ * median of each, and the overhead as the median of the per pass on / off ratios ( the two
+ * runs of a pass are back to back, slow drift of the machine cancels out ).
+ *
+ * Below the tick rate of the kernel the overhead is smaller than the run to run noise of
+ * most machines, so the "on" child also counts the SIGPROF signals it took ( the kernel
+ * checks cpu clock timers on its tick, above the tick rate overruns stand in for signals )
+ * and times SIGNAL_ROUNDS x SIGNAL_BATCH pthread_kill() round trips through the sampler's
+ * handler. Signals per cpu second times ns per signal gives "bound_percent", an upper
+ * bound : a pthread_kill() round trip includes a system call a timer signal does not make.
+ *
+ * sampler-bench [--hz=N] [--passes=N] [--output=FILE]
+ *
+ * build : cc -O2 -fcommon -o sampler-bench bench/sampler-bench.c instruction-set.c execute.c fuzz.c hot-trace.c hle.c core/[a-z]*.c -lm -lpthread -lrt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/wait.h>
+
+#include "../core/core.h"
+#include "../core/sampler.h"
+#include "../execute.h"
+
+enum { 
+    DEFAULT_PASSES = 9,
+    MAX_PASSES     = 64,
+    CODE_ORIGIN    = 0x3000,
+    ARRAY          = 0x4000,
+    ARRAY_LENGTH   = 256,
+    OUTER_COUNT    = 8000,      // about 14M instructions
+    SIGNAL_ROUNDS  = 20,
+    SIGNAL_BATCH   = 2000,      // below SAMPLE_RING_SIZE, the ring drains between rounds
+}; 
+
+enum { 
+    MODE_OFF = 0,
+    MODE_ON,
+    MODE_COUNT,
+}; 
+
+static const char* mode_names[MODE_COUNT] = { "off", "on" }; 
+
+// what a child sends back : ns per instruction, interpreter thread and process, "on" only : the signals
+struct result { 
+    double thread_ns; 
+    double process_ns; 
+    double signals_per_second; 
+    double ns_per_signal; 
+}; 
+
+// the sampler's SIGPROF handler and how often it ran
+static void (*sample_handler)(int); 
+static uint64_t signals; 
+
+static void count_signal(int signal) { 
+    ++signals; 
+    sample_handler(signal); 
+}
+
+/*
+ *         LD   R4, outer_count
+ * outer : LD   R1, base          LD   R2, count
+ * inner : JSR  add               ADD  R1, R1, #1      ADD  R2, R2, #-1    BRp inner
+ *         ADD  R4, R4, #-1       BRp  outer           HALT
+ * add :   LDR  R3, R1, #0        ADD  R0, R0, R3      RET
+ */
+static const uint16_t program[] = { 
+    0x2809,     // LD R4, outer_count
+    0x2209,     // outer : LD R1, base
+    0x2409,     // LD R2, count
+    0x4809,     // inner : JSR add
+    0x1261,     // ADD R1, R1, #1
+    0x14BF,     // ADD R2, R2, #-1
+    0x03FC,     // BRp inner
+    0x193F,     // ADD R4, R4, #-1
+    0x03F8,     // BRp outer
+    0xF025,     // HALT
+    0,          // outer_count
+    ARRAY,      // base
+    ARRAY_LENGTH, // count
+    0x6640,     // add : LDR R3, R1, #0
+    0x1003,     // ADD R0, R0, R3
+    0xC1C0,     // RET
+}; 
+
+static uint64_t clock_ns(clockid_t clock) { 
+    struct timespec now; 
+    clock_gettime(clock, &now); 
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec; 
+}
+
+// ns per pthread_kill() round trip through the handler, the sampler still open
+static double time_signal() { 
+    uint64_t spent = 0; 
+    for(int round = 0; round < SIGNAL_ROUNDS; ++round) { 
+        uint64_t start = clock_ns(CLOCK_THREAD_CPUTIME_ID); 
+        for(int i = 0; i < SIGNAL_BATCH; ++i) pthread_kill(pthread_self(), SIGPROF); 
+        spent += clock_ns(CLOCK_THREAD_CPUTIME_ID) - start; 
+        usleep(2 * SAMPLE_DRAIN_MS * 1000); 
+    }
+    return (double) spent / (SIGNAL_ROUNDS * SIGNAL_BATCH); 
+}
+
+static void child(int mode, int hz, int channel) { 
+    for(size_t i = 0; i < sizeof(program) / sizeof(program[0]); ++i) memory[CODE_ORIGIN + i] = program[i]; 
+    memory[CODE_ORIGIN + 10] = OUTER_COUNT; 
+    for(int i = 0; i < ARRAY_LENGTH; ++i) memory[ARRAY + i] = (uint16_t) (i * 2654435761u >> 7); 
+    registers[R_PC] = CODE_ORIGIN; 
+    registers[R_COND] = FL_ZRO; 
+
+    // HALT prints
+    int null = open("/dev/null", O_WRONLY); 
+    dup2(null, STDOUT_FILENO); 
+    close(null); 
+    if(mode == MODE_ON) { 
+        if(!sampler_open("/dev/null", hz)) _exit(1); 
+        struct sigaction action; 
+        sigaction(SIGPROF, NULL, &action); 
+        sample_handler = action.sa_handler; 
+        action.sa_handler = count_signal; 
+        sigaction(SIGPROF, &action, NULL); 
+    }
+
+    uint64_t thread = clock_ns(CLOCK_THREAD_CPUTIME_ID); 
+    uint64_t process = clock_ns(CLOCK_PROCESS_CPUTIME_ID); 
+    running = 1; 
+    while(running) fetchExecute(); 
+    thread = clock_ns(CLOCK_THREAD_CPUTIME_ID) - thread; 
+    struct result result = { 0 }; 
+    if(mode == MODE_ON) { 
+        result.signals_per_second = signals * 1e9 / thread; 
+        result.ns_per_signal = time_signal(); 
+        sampler_close(); 
+    }
+    process = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - process - (uint64_t) (result.ns_per_signal * SIGNAL_ROUNDS * SIGNAL_BATCH); 
+    result.thread_ns = (double) thread / instructions_retired; 
+    result.process_ns = (double) process / instructions_retired; 
+    _exit(write(channel, &result, sizeof(result)) == sizeof(result) ? 0 : 1); 
+}
+
+static int measure(int mode, int hz, struct result* result) { 
+    int channel[2]; 
+    if(pipe(channel) != 0) return 0; 
+    fflush(stdout); 
+    pid_t pid = fork(); 
+    if(pid < 0) return 0; 
+    if(pid == 0) { 
+        close(channel[0]); 
+        child(mode, hz, channel[1]); 
+    }
+    close(channel[1]); 
+    int ok = read(channel[0], result, sizeof(*result)) == sizeof(*result); 
+    close(channel[0]); 
+    int status; 
+    waitpid(pid, &status, 0); 
+    return ok && WIFEXITED(status) && WEXITSTATUS(status) == 0; 
+}
+
+static int by_value(const void* a, const void* b) { 
+    double x = *(const double*) a, y = *(const double*) b; 
+    return x < y ? -1 : x > y; 
+}
+
+// sorts values
+static double median(double* values, int count) { 
+    qsort(values, count, sizeof(double), by_value); 
+    return count % 2 ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2; 
+}
+
+
+int main(int argc, const char* argv[]) { 
+    int hz = SAMPLE_DEFAULT_HZ; 
+    int passes = DEFAULT_PASSES; 
+    FILE* output = stdout; 
+    for(int j = 1; j < argc; ++j) { 
+        if(strncmp(argv[j], "--hz=", 5) == 0) { 
+            hz = atoi(argv[j] + 5); 
+        }else if(strncmp(argv[j], "--passes=", 9) == 0) { 
+            passes = atoi(argv[j] + 9); 
+        }else if(strncmp(argv[j], "--output=", 9) == 0) { 
+            output = fopen(argv[j] + 9, "w"); 
+            if(!output) { 
+                perror(argv[j] + 9); 
+                return 1; 
+            }
+        }else { 
+            printf("sampler-bench [--hz=N] [--passes=N] [--output=FILE]\n"); 
+            return 2; 
+        }
+    }
+    if(passes < 1) passes = 1; 
+    if(passes > MAX_PASSES) passes = MAX_PASSES; 
+
+    double thread[MODE_COUNT][MAX_PASSES], process[MODE_COUNT][MAX_PASSES]; 
+    double signals_per_second[MAX_PASSES], ns_per_signal[MAX_PASSES]; 
+    for(int pass = 0; pass < passes; ++pass) { 
+        for(int mode = 0; mode < MODE_COUNT; ++mode) { 
+            struct result result; 
+            if(!measure(mode, hz, &result)) { 
+                fprintf(stderr, "sampler-bench : run failed ( mode %s )\n", mode_names[mode]); 
+                return 1; 
+            }
+            thread[mode][pass] = result.thread_ns; 
+            process[mode][pass] = result.process_ns; 
+            if(mode == MODE_ON) { 
+                signals_per_second[pass] = result.signals_per_second; 
+                ns_per_signal[pass] = result.ns_per_signal; 
+            }
+        }
+    }
+
+    double thread_ratio[MAX_PASSES], process_ratio[MAX_PASSES]; 
+    for(int pass = 0; pass < passes; ++pass) { 
+        thread_ratio[pass] = thread[MODE_ON][pass] / thread[MODE_OFF][pass]; 
+        process_ratio[pass] = process[MODE_ON][pass] / process[MODE_OFF][pass]; 
+    }
+    double thread_overhead = 100 * (median(thread_ratio, passes) - 1); 
+    double process_overhead = 100 * (median(process_ratio, passes) - 1); 
+    double rate = median(signals_per_second, passes), cost = median(ns_per_signal, passes); 
+
+    fprintf(output, "{\n  \"hz\": %d,\n  \"passes\": %d,\n  \"results\": [", hz, passes); 
+    for(int mode = 0; mode < MODE_COUNT; ++mode) { 
+        fprintf(output, "%s\n    { \"sampler\": \"%s\", \"thread_ns\": %.3f, \"process_ns\": %.3f }", mode ? "," : "",
+                mode_names[mode], median(thread[mode], passes), median(process[mode], passes)); 
+    }
+    fprintf(output, "\n  ],\n  \"signals_per_cpu_second\": %.1f,\n  \"ns_per_signal\": %.1f,\n  \"bound_percent\": %.3f,\n", 
+            rate, cost, rate * cost / 1e7); 
+    fprintf(output, "  \"thread_overhead_percent\": %.2f,\n  \"process_overhead_percent\": %.2f\n}\n", thread_overhead, process_overhead); 
+    if(output != stdout) fclose(output); 
+    return 0; 
+}
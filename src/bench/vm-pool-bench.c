@@ -0,0 +1,262 @@
+/*
+ * VM pool benchmark.
+ *
+ * Worker processes repeatedly bring up VMS contexts, run a short guest on each through the
+ * interpreter ( fetchExecute() on the context's own memory, the guest stores every 8th
+ * word of TOUCH data pages ), then tear them all down again. "malloc" gets every context
+ * from calloc() and returns it with free(), "pool" uses vm-pool.c with the workers pinned
+ * one per cpu. Workers are processes, not threads : the interpreter state is per process.
+ * Reported : wall time per context life cycle and minor page faults.
+ *
+ * vm-pool-bench [--vms=N] [--rounds=N] [--workers=N] [--touch=PAGES] [--mode=malloc|pool] [--output=FILE]
+ *
+ * build : cc -O2 -fcommon -o vm-pool-bench bench/vm-pool-bench.c instruction-set.c execute.c fuzz.c hot-trace.c hle.c core/[a-z]*.c -lm -lpthread -lrt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "../core/core.h"
+#include "../core/vm-pool.h"
+#include "../core/image-cache.h"
+#include "../execute.h"
+
+enum { 
+    DEFAULT_VMS    = 4096,
+    DEFAULT_ROUNDS = 8,
+    DEFAULT_TOUCH  = 4,
+    MAX_TOUCH      = 32,         // keeps the guest's LD offsets within 9 bits
+    GUEST_ORIGIN   = 0x3000,
+    FIRST_PAGE     = 0x40,
+}; 
+
+enum { 
+    MODE_MALLOC = 0,
+    MODE_POOL,
+    MODE_COUNT,
+}; 
+
+static const char* mode_names[MODE_COUNT] = { "malloc", "pool" }; 
+
+// what a worker process sends back through its pipe
+struct result { 
+    uint64_t checksum; 
+    uint64_t instructions; 
+    size_t cycles; 
+    long faults; 
+    int failed; 
+    int nodes; 
+    int huge; 
+}; 
+
+static uint16_t guest_words[7 * MAX_TOUCH + 1]; 
+static struct cached_image guest; 
+static uint16_t guest_end; 
+
+static uint64_t now_ns() { 
+    struct timespec now; 
+    clock_gettime(CLOCK_MONOTONIC, &now); 
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec; 
+}
+
+static long minor_faults() { 
+    struct rusage usage; 
+    getrusage(RUSAGE_SELF, &usage); 
+    return usage.ru_minflt; 
+}
+
+static uint16_t page_of(int p) { 
+    return FIRST_PAGE + p * 5; 
+}
+
+/*
+ * Per data page :
+ *     LD   R1, base          LD   R2, count
+ *     loop : STR R0, R1, #0  ADD R1, R1, #8  ADD R2, R2, #-1  BRp loop
+ * then the count and the page bases. The run ends when PC reaches the count word.
+ */
+static void generate_guest(int touch) { 
+    int code = 6 * touch; 
+    int count_word = code; 
+    for(int p = 0; p < touch; ++p) { 
+        int at = 6 * p; 
+        int base_word = code + 1 + p; 
+        guest_words[at + 0] = 0x2000 | (1 << 9) | ((base_word - (at + 1)) & 0x1FF); 
+        guest_words[at + 1] = 0x2000 | (2 << 9) | ((count_word - (at + 2)) & 0x1FF); 
+        guest_words[at + 2] = 0x7000 | (0 << 9) | (1 << 6); 
+        guest_words[at + 3] = 0x1000 | (1 << 9) | (1 << 6) | 0x20 | 8; 
+        guest_words[at + 4] = 0x1000 | (2 << 9) | (2 << 6) | 0x20 | (-1 & 0x1F); 
+        guest_words[at + 5] = 0x0000 | (1 << 9) | (-4 & 0x1FF); 
+        guest_words[base_word] = (uint16_t) (page_of(p) << PAGE_SHIFT); 
+    }
+    guest_words[count_word] = PAGE_SIZE / 8; 
+    guest.origin = GUEST_ORIGIN; 
+    guest.length = code + 1 + touch; 
+    guest.words = guest_words; 
+    guest_end = GUEST_ORIGIN + code; 
+}
+
+static void run_guest(struct vm_context* vm, int round, struct result* result) { 
+    vm_context_load_image(vm, &guest); 
+    vm->registers[R_PC] = GUEST_ORIGIN; 
+    vm->registers[R_R0] = (uint16_t) round; 
+    vm_context_load(vm); 
+    uint64_t retired = instructions_retired; 
+    while(registers[R_PC] != guest_end) fetchExecute(); 
+    result->instructions += instructions_retired - retired; 
+    vm_context_save(vm); 
+    vm->output_size = snprintf(vm->output, VM_IO_SIZE, "round %d\n", round); 
+}
+
+static void work(int index, int mode, size_t count, int rounds, int cpus, struct result* result) { 
+    struct vm_pool pool; 
+    if(mode == MODE_POOL) { 
+        vm_worker_pin(index % cpus); 
+        if(!vm_pool_create(&pool, count ? count : 1)) { 
+            result->failed = 1; 
+            return; 
+        }
+        result->nodes = pool.nodes; 
+        result->huge = pool.arenas[0].huge; 
+    }
+    struct vm_context** live = calloc(count ? count : 1, sizeof(struct vm_context*)); 
+    long faults = minor_faults(); 
+    for(int round = 0; round < rounds; ++round) { 
+        for(size_t i = 0; i < count; ++i) { 
+            struct vm_context* vm = mode == MODE_POOL ? vm_alloc(&pool) : calloc(1, sizeof(struct vm_context)); 
+            if(!vm) { 
+                result->failed = 1; 
+                count = i; 
+                break; 
+            }
+            run_guest(vm, round, result); 
+            live[i] = vm; 
+        }
+        vm_context_unload(); 
+        for(size_t i = 0; i < count; ++i) { 
+            struct vm_context* vm = live[i]; 
+            // a fresh context must come back zeroed outside what the guest wrote
+            result->checksum += vm->memory[page_of(0) << PAGE_SHIFT] + vm->memory[0x8000] + vm->registers[R_R2]; 
+            if(mode == MODE_POOL) vm_free(&pool, vm); 
+            else free(vm); 
+        }
+        result->cycles += count; 
+    }
+    result->faults = minor_faults() - faults; 
+    free(live); 
+    if(mode == MODE_POOL) vm_pool_destroy(&pool); 
+}
+
+static int measure(FILE* output, int mode, size_t vms, int rounds, int workers, int* first) { 
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN); 
+    if(cpus < 1) cpus = 1; 
+    int channel[2]; 
+    if(pipe(channel) != 0) { 
+        perror("pipe"); 
+        return 0; 
+    }
+
+    uint64_t start = now_ns(); 
+    for(int w = 0; w < workers; ++w) { 
+        pid_t child = fork(); 
+        if(child < 0) { 
+            perror("fork"); 
+            return 0; 
+        }
+        if(child == 0) { 
+            close(channel[0]); 
+            struct result result = { 0 }; 
+            size_t count = vms / workers + (w < (int) (vms % workers)); 
+            work(w, mode, count, rounds, cpus, &result); 
+            ssize_t written = write(channel[1], &result, sizeof(result)); 
+            _exit(written == sizeof(result) ? 0 : 1); 
+        }
+    }
+    close(channel[1]); 
+
+    struct result total = { 0 }, result; 
+    int received = 0; 
+    while(read(channel[0], &result, sizeof(result)) == sizeof(result)) { 
+        total.checksum += result.checksum; 
+        total.instructions += result.instructions; 
+        total.cycles += result.cycles; 
+        total.faults += result.faults; 
+        total.failed |= result.failed; 
+        total.nodes = result.nodes; 
+        total.huge = result.huge; 
+        ++received; 
+    }
+    close(channel[0]); 
+    while(wait(NULL) > 0); 
+    uint64_t elapsed = now_ns() - start; 
+    if(received != workers) total.failed = 1; 
+
+    size_t cycles = total.cycles; 
+    fprintf(output, "%s\n    { \"mode\": \"%s\", \"seconds\": %.3f, \"ns_per_vm\": %.1f, \"instructions_per_vm\": %.1f, \"minor_faults\": %ld, \"faults_per_vm\": %.2f, \"checksum\": %llu",
+            *first ? "" : ",", mode_names[mode], elapsed / 1e9, cycles ? (double) elapsed / cycles : 0.0,
+            cycles ? (double) total.instructions / cycles : 0.0,
+            total.faults, cycles ? (double) total.faults / cycles : 0.0, (unsigned long long) total.checksum); 
+    if(mode == MODE_POOL) { 
+        fprintf(output, ", \"nodes\": %d, \"huge_pages\": %s", total.nodes, total.huge ? "true" : "false"); 
+    }
+    fprintf(output, "%s }", total.failed ? ", \"failed\": true" : ""); 
+    fflush(output); 
+    *first = 0; 
+    return !total.failed; 
+}
+
+int main(int argc, const char* argv[]) { 
+    size_t vms = DEFAULT_VMS; 
+    int rounds = DEFAULT_ROUNDS; 
+    int workers = sysconf(_SC_NPROCESSORS_ONLN); 
+    int touch = DEFAULT_TOUCH; 
+    int only = -1; 
+    FILE* output = stdout; 
+    for(int j = 1; j < argc; ++j) { 
+        if(strncmp(argv[j], "--vms=", 6) == 0) { 
+            vms = strtoul(argv[j] + 6, NULL, 10); 
+        }else if(strncmp(argv[j], "--rounds=", 9) == 0) { 
+            rounds = atoi(argv[j] + 9); 
+        }else if(strncmp(argv[j], "--workers=", 10) == 0) { 
+            workers = atoi(argv[j] + 10); 
+        }else if(strncmp(argv[j], "--touch=", 8) == 0) { 
+            touch = atoi(argv[j] + 8); 
+        }else if(strcmp(argv[j], "--mode=malloc") == 0) { 
+            only = MODE_MALLOC; 
+        }else if(strcmp(argv[j], "--mode=pool") == 0) { 
+            only = MODE_POOL; 
+        }else if(strncmp(argv[j], "--output=", 9) == 0) { 
+            output = fopen(argv[j] + 9, "w"); 
+            if(!output) { 
+                perror(argv[j] + 9); 
+                return 1; 
+            }
+        }else { 
+            printf("vm-pool-bench [--vms=N] [--rounds=N] [--workers=N] [--touch=PAGES] [--mode=malloc|pool] [--output=FILE]\n"); 
+            return 2; 
+        }
+    }
+    if(workers < 1) workers = 1; 
+    if(rounds < 1) rounds = 1; 
+    if(touch < 0) touch = 0; 
+    if(touch > MAX_TOUCH) touch = MAX_TOUCH; 
+    generate_guest(touch); 
+
+    fprintf(output, "{\n  \"vms\": %zu,\n  \"rounds\": %d,\n  \"workers\": %d,\n  \"touch\": %d,\n  \"context_bytes\": %zu,\n  \"results\": [",
+            vms, rounds, workers, touch, sizeof(struct vm_context)); 
+    fflush(output); 
+    int first = 1, ok = 1; 
+    for(int mode = 0; mode < MODE_COUNT; ++mode) { 
+        if(only >= 0 && mode != only) continue; 
+        ok &= measure(output, mode, vms, rounds, workers, &first); 
+    }
+    fprintf(output, "\n  ]\n}\n"); 
+    if(output != stdout) fclose(output); 
+    return ok ? 0 : 1; 
+}
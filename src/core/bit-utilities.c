@@ -1,4 +1,4 @@
-#include<stdin.h> 
+#include<stdint.h> 
 #include "bit-utilities.h"
 
 
@@ -15,7 +15,7 @@ uint16_t swap16(uint16_t x) {
 // Sign extend a two's complement number to 16 bits for immediate mode 
 uint16_t sign_extend(uint16_t x, int bit_count) { 
     if (( x >> (bit_count - 1 )) & 1) { 
-        x |= (0xFFFF << bit_count)
+        x |= (0xFFFF << bit_count); 
     } 
     return x; 
 }
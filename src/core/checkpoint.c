@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "core.h"
+#include "checkpoint.h"
+#include "compress.h"
+#include "debug.h"
+
+// next file in the chain, 0 means the next checkpoint is a full one
+static uint32_t sequence; 
+
+// restored but not yet copied in pages point into a mapped checkpoint file
+static const uint16_t* lazy_source[PAGE_COUNT]; 
+
+static struct { 
+    void* address; 
+    size_t size; 
+} mappings[CHECKPOINT_MAX_MAPPINGS]; 
+static int mapping_count; 
+
+// copy a restored page in ( called from the mem_read()/mem_write() slow path )
+void checkpoint_fault(uint16_t page) { 
+    memcpy(memory + ((size_t) page << PAGE_SHIFT), lazy_source[page], PAGE_SIZE * sizeof(uint16_t)); 
+    lazy_source[page] = NULL; 
+    page_attributes[page] &= ~PAGE_LAZY; 
+}
+
+static void fault_all() { 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        if(page_attributes[page] & PAGE_LAZY) checkpoint_fault(page); 
+        if(page_attributes[page] & PAGE_COMPRESSED) compress_fault(page); 
+    }
+}
+
+static void unmap_all() { 
+    for(int i = 0; i < mapping_count; ++i) { 
+        munmap(mappings[i].address, mappings[i].size); 
+    }
+    mapping_count = 0; 
+}
+
+static void file_name(char* name, size_t size, const char* prefix, uint32_t n) { 
+    snprintf(name, size, "%s.%u", prefix, n); 
+}
+
+/*
+ * Write the next checkpoint of the chain.
+ * The first one holds every non zero page, later ones only the pages
+ * dirtied since the last checkpoint ( or restore ).
+ */
+int checkpoint_save(const char* prefix) { 
+    static struct checkpoint_header header; 
+    static struct iovec parts[PAGE_COUNT + 1]; 
+    // pages holding breakpoints are saved from a copy with the guest's words put back
+    static uint16_t unpatched[DEBUG_MAX_BREAKPOINTS][PAGE_SIZE]; 
+    int unpatched_count = 0; 
+    int full = sequence == 0; 
+
+    if(full) fault_all(); 
+
+    memset(&header, 0, sizeof(header)); 
+    header.magic = CHECKPOINT_MAGIC; 
+    header.version = CHECKPOINT_VERSION; 
+    header.flags = full ? CHECKPOINT_FULL : 0; 
+    header.sequence = sequence; 
+    memcpy(header.registers, registers, sizeof(header.registers)); 
+
+    int count = 0; 
+    parts[count].iov_base = &header; 
+    parts[count].iov_len = sizeof(header); 
+    ++count; 
+
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        uint16_t* words = memory + ((size_t) page << PAGE_SHIFT); 
+        if(page_attributes[page] & PAGE_BREAKPOINT) { 
+            memcpy(unpatched[unpatched_count], words, PAGE_SIZE * sizeof(uint16_t)); 
+            debug_original_words(page, unpatched[unpatched_count]); 
+            words = unpatched[unpatched_count++]; 
+        }
+        int store; 
+        if(full) { 
+            store = 0; 
+            for(size_t i = 0; i < PAGE_SIZE; ++i) { 
+                if(words[i]) { store = 1; break; } 
+            }
+        }else { 
+            store = dirty_pages[page] & DIRTY_CHECKPOINT; 
+            // written before an idle pass : memory[] no longer holds the words
+            if(store && (page_attributes[page] & PAGE_COMPRESSED)) compress_fault(page); 
+        }
+        if(!store) continue; 
+
+        header.page_slot[page] = ++header.page_count; 
+        parts[count].iov_base = words; 
+        parts[count].iov_len = PAGE_SIZE * sizeof(uint16_t); 
+        ++count; 
+    }
+
+    char name[4096]; 
+    file_name(name, sizeof(name), prefix, sequence); 
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644); 
+    if(fd < 0) return 0; 
+
+    size_t expected = sizeof(header) + (size_t) header.page_count * PAGE_SIZE * sizeof(uint16_t); 
+    ssize_t written = writev(fd, parts, count); 
+    close(fd); 
+    if(written < 0 || (size_t) written != expected) return 0; 
+
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        dirty_pages[page] &= ~DIRTY_CHECKPOINT; 
+    }
+    ++sequence; 
+    return 1; 
+}
+
+// map one file of the chain, its pages become lazy
+static int restore_file(const char* name, uint32_t expected_sequence) { 
+    int fd = open(name, O_RDONLY); 
+    if(fd < 0) return 0; 
+    struct stat st; 
+    if(fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct checkpoint_header)) { 
+        close(fd); 
+        return 0; 
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); 
+    close(fd); 
+    if(base == MAP_FAILED) return 0; 
+
+    const struct checkpoint_header* header = base; 
+    size_t expected = sizeof(*header) + (size_t) header->page_count * PAGE_SIZE * sizeof(uint16_t); 
+    int full = header->flags & CHECKPOINT_FULL; 
+    if(header->magic != CHECKPOINT_MAGIC || header->version != CHECKPOINT_VERSION 
+            || header->sequence != expected_sequence || (size_t) st.st_size < expected 
+            || (full != 0) != (expected_sequence == 0)) { 
+        munmap(base, st.st_size); 
+        return 0; 
+    }
+
+    // too many files mapped, copy everything in and start over
+    if(mapping_count == CHECKPOINT_MAX_MAPPINGS) { 
+        fault_all(); 
+        unmap_all(); 
+    }
+    mappings[mapping_count].address = base; 
+    mappings[mapping_count].size = st.st_size; 
+    ++mapping_count; 
+
+    const uint16_t* data = (const uint16_t*) (header + 1); 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        if(header->page_slot[page]) { 
+            lazy_source[page] = data + (size_t) (header->page_slot[page] - 1) * PAGE_SIZE; 
+            page_attributes[page] |= PAGE_LAZY; 
+            dirty_pages[page] = DIRTY_ALL & ~DIRTY_CHECKPOINT; 
+        }
+    }
+    memcpy(registers, header->registers, sizeof(header->registers)); 
+    return 1; 
+}
+
+/*
+ * Restore the whole chain PREFIX.0, PREFIX.1, ...
+ * Only the headers are read here, page contents are copied in when first touched.
+ * Later checkpoints continue the same chain.
+ */
+int checkpoint_restore(const char* prefix) { 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        lazy_source[page] = NULL; 
+        page_attributes[page] &= ~PAGE_LAZY; 
+    }
+    unmap_all(); 
+    memset(memory, 0, (UINT16_MAX + 1) * sizeof(uint16_t)); 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        dirty_pages[page] = DIRTY_ALL & ~DIRTY_CHECKPOINT; 
+    }
+
+    char name[4096]; 
+    uint32_t n = 0; 
+    while(1) { 
+        file_name(name, sizeof(name), prefix, n); 
+        if(access(name, F_OK) != 0) break; 
+        if(!restore_file(name, n)) return 0; 
+        ++n; 
+    }
+    sequence = n; 
+    return n > 0; 
+}
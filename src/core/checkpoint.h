@@ -0,0 +1,40 @@
+#ifndef _CHECKPOINT
+#define _CHECKPOINT
+
+#include<stdint.h> 
+
+#include "core.h"
+
+/*
+ * Checkpoint files.
+ *
+ * A checkpoint chain is PREFIX.0, PREFIX.1, ...
+ * PREFIX.0 is a full checkpoint ( pages missing from it are zero ),
+ * every later file only holds the pages written since the previous one.
+ *
+ * File layout ( host byte order ) :
+ *   struct checkpoint_header
+ *   page data, PAGE_SIZE words per stored page, in increasing page order
+ */
+enum { 
+    CHECKPOINT_MAGIC   = 0x43334C43, // "LC3C"
+    CHECKPOINT_VERSION = 1, 
+    CHECKPOINT_FULL    = 1 << 0,     // header flag
+    CHECKPOINT_MAX_MAPPINGS = 64,    // files kept mapped for lazy restore
+};
+
+struct checkpoint_header { 
+    uint32_t magic; 
+    uint16_t version; 
+    uint16_t flags; 
+    uint32_t sequence;                 // position in the chain
+    uint16_t page_count;               // pages stored in this file
+    uint16_t registers[R_COUNT];       // R0-R7, PC and COND
+    uint16_t page_slot[PAGE_COUNT];    // 0 = not stored, n = n-th stored page
+};
+
+int checkpoint_save(const char* prefix); 
+int checkpoint_restore(const char* prefix); 
+void checkpoint_fault(uint16_t page); 
+
+#endif
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+
+#include "core.h"
+#include "compress.h"
+
+enum { 
+    KIND_ZERO = 0,
+    KIND_IMAGE,
+    KIND_CODED,
+}; 
+
+// token word : kind in the top two bits, count of words in the rest
+enum { 
+    TOKEN_LITERAL = 0 << 14,          // count words follow
+    TOKEN_RUN     = 1 << 14,          // first word and step follow : x, x + step, x + 2 step ...
+    TOKEN_MATCH   = 2 << 14,          // distance back follows, count words copied from there
+    TOKEN_KIND    = 3 << 14,
+    MIN_RUN       = 4,                // shorter runs and matches stay literal
+    MIN_MATCH     = 3,
+    HASH_BITS     = 8,
+}; 
+
+static struct { 
+    uint8_t kind; 
+    uint16_t size;                    // words of data
+    uint16_t* data; 
+} pages[PAGE_COUNT]; 
+
+static const struct cached_image* baselines[COMPRESS_MAX_BASELINES]; 
+static int baseline_count; 
+
+// keeps the image cache entry, pages still equal to it are not stored at all
+void compress_baseline(const struct cached_image* image) { 
+    if(!image) return; 
+    if(baseline_count == COMPRESS_MAX_BASELINES) { 
+        image_cache_release(image); 
+        return; 
+    }
+    baselines[baseline_count++] = image; 
+}
+
+// what the loaded images put in a page, later images over earlier ones
+static void baseline_page(uint16_t page, uint16_t words[PAGE_SIZE]) { 
+    uint32_t start = (uint32_t) page << PAGE_SHIFT; 
+    memset(words, 0, PAGE_SIZE * sizeof(uint16_t)); 
+    for(int i = 0; i < baseline_count; ++i) { 
+        const struct cached_image* image = baselines[i]; 
+        uint32_t from = image->origin > start ? image->origin : start; 
+        uint32_t to = (uint32_t) image->origin + image->length; 
+        if(to > start + PAGE_SIZE) to = start + PAGE_SIZE; 
+        if(from >= to) continue; 
+        memcpy(words + (from - start), image->words + (from - image->origin), (to - from) * sizeof(uint16_t)); 
+    }
+}
+
+static uint32_t hash_pair(uint16_t a, uint16_t b) { 
+    return ((uint32_t) a * 0x9E37 ^ b) * 0x85EBCA6Bu >> (32 - HASH_BITS); 
+}
+
+static int emit_literals(uint16_t* out, size_t* size, const uint16_t* words, size_t count) { 
+    if(!count) return 1; 
+    if(*size + 1 + count >= PAGE_SIZE) return 0; 
+    out[(*size)++] = TOKEN_LITERAL | count; 
+    memcpy(out + *size, words, count * sizeof(uint16_t)); 
+    *size += count; 
+    return 1; 
+}
+
+// words of coded data, 0 when coding does not make the page smaller
+static size_t encode(const uint16_t* words, uint16_t* out) { 
+    uint16_t head[1 << HASH_BITS]; 
+    memset(head, 0xFF, sizeof(head)); 
+    size_t size = 0, literal = 0, i = 0; 
+    while(i < PAGE_SIZE) { 
+        // a run of equal words or of a counter ( tables, pointer arrays )
+        uint16_t step = i + 1 < PAGE_SIZE ? words[i + 1] - words[i] : 0; 
+        size_t run = 1; 
+        while(i + run < PAGE_SIZE && words[i + run] == (uint16_t) (words[i] + run * step)) ++run; 
+        size_t match = 0, distance = 0; 
+        if(i + 1 < PAGE_SIZE) { 
+            uint32_t h = hash_pair(words[i], words[i + 1]); 
+            if(head[h] != 0xFFFF) { 
+                size_t from = head[h]; 
+                while(i + match < PAGE_SIZE && words[from + match] == words[i + match]) ++match; 
+                distance = i - from; 
+            }
+            head[h] = i; 
+        }
+        if(run < MIN_RUN && match < MIN_MATCH) { 
+            ++i; 
+            continue; 
+        }
+        if(!emit_literals(out, &size, words + literal, i - literal)) return 0; 
+        if(size + 3 >= PAGE_SIZE) return 0; 
+        if(run >= MIN_RUN && run >= match) { 
+            out[size++] = TOKEN_RUN | run; 
+            out[size++] = words[i]; 
+            out[size++] = step; 
+            i += run; 
+        }else { 
+            out[size++] = TOKEN_MATCH | match; 
+            out[size++] = distance; 
+            i += match; 
+        }
+        literal = i; 
+    }
+    if(!emit_literals(out, &size, words + literal, i - literal)) return 0; 
+    return size; 
+}
+
+static void decode(const uint16_t* data, size_t size, uint16_t* words) { 
+    size_t i = 0, at = 0; 
+    while(i < size) { 
+        uint16_t token = data[i++]; 
+        size_t count = token & ~TOKEN_KIND; 
+        switch(token & TOKEN_KIND) { 
+        case TOKEN_LITERAL:
+            memcpy(words + at, data + i, count * sizeof(uint16_t)); 
+            i += count; 
+            break; 
+        case TOKEN_RUN:
+            for(size_t k = 0; k < count; ++k) words[at + k] = data[i] + k * data[i + 1]; 
+            i += 2; 
+            break; 
+        default:
+            // may overlap itself, copy forward one word at a time
+            for(size_t k = 0; k < count; ++k) words[at + k] = words[at - data[i] + k]; 
+            ++i; 
+            break; 
+        }
+        at += count; 
+    }
+}
+
+static int compress_page(uint16_t page) { 
+    const uint16_t* words = memory + ((size_t) page << PAGE_SHIFT); 
+    static uint16_t scratch[PAGE_SIZE]; 
+
+    int zero = 1; 
+    for(size_t i = 0; i < PAGE_SIZE && zero; ++i) zero = words[i] == 0; 
+    if(zero) { 
+        pages[page].kind = KIND_ZERO; 
+        ++compress_stats.zero_pages; 
+        return 1; 
+    }
+    baseline_page(page, scratch); 
+    if(memcmp(words, scratch, sizeof(scratch)) == 0) { 
+        pages[page].kind = KIND_IMAGE; 
+        ++compress_stats.image_pages; 
+        return 1; 
+    }
+    size_t size = encode(words, scratch); 
+    if(!size) return 0; 
+    pages[page].data = malloc(size * sizeof(uint16_t)); 
+    if(!pages[page].data) return 0; 
+    memcpy(pages[page].data, scratch, size * sizeof(uint16_t)); 
+    pages[page].kind = KIND_CODED; 
+    pages[page].size = size; 
+    compress_stats.stored_bytes += size * sizeof(uint16_t); 
+    return 1; 
+}
+
+// host pages lying entirely inside memory[] with every guest page on them compressed
+static void release_host_pages() { 
+    size_t host = sysconf(_SC_PAGESIZE); 
+    if(host < PAGE_SIZE * sizeof(uint16_t)) return; 
+    uintptr_t base = (uintptr_t) memory; 
+    uintptr_t first = (base + host - 1) / host * host; 
+    uintptr_t end = base + sizeof(uint16_t) * (UINT16_MAX + 1); 
+    compress_stats.released_bytes = 0; 
+    for(uintptr_t address = first; address + host <= end; address += host) { 
+        // memory[] need not be host page aligned, a host page may hold parts of 9 guest pages
+        size_t page = (address - base) / (PAGE_SIZE * sizeof(uint16_t)); 
+        size_t last = (address + host - 1 - base) / (PAGE_SIZE * sizeof(uint16_t)); 
+        int all = 1; 
+        for(; page <= last && all; ++page) all = (page_attributes[page] & PAGE_COMPRESSED) != 0; 
+        if(all && madvise((void*) address, host, MADV_DONTNEED) == 0) compress_stats.released_bytes += host; 
+    }
+}
+
+// only plain pages : devices, lazy, traced, watched ... pages stay as they are ( PAGE_CODE is fine )
+void compress_memory() { 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        if(page_attributes[page] & ~PAGE_CODE) continue; 
+        if(!compress_page(page)) continue; 
+        page_attributes[page] |= PAGE_COMPRESSED; 
+        ++compress_stats.compressed_pages; 
+    }
+    release_host_pages(); 
+}
+
+// called from the mem_read()/mem_write() slow path
+void compress_fault(uint16_t page) { 
+    uint16_t* words = memory + ((size_t) page << PAGE_SHIFT); 
+    switch(pages[page].kind) { 
+    case KIND_ZERO:
+        memset(words, 0, PAGE_SIZE * sizeof(uint16_t)); 
+        --compress_stats.zero_pages; 
+        break; 
+    case KIND_IMAGE:
+        baseline_page(page, words); 
+        --compress_stats.image_pages; 
+        break; 
+    default:
+        decode(pages[page].data, pages[page].size, words); 
+        compress_stats.stored_bytes -= pages[page].size * sizeof(uint16_t); 
+        free(pages[page].data); 
+        pages[page].data = NULL; 
+        break; 
+    }
+    page_attributes[page] &= ~PAGE_COMPRESSED; 
+    --compress_stats.compressed_pages; 
+    ++compress_stats.wakes; 
+}
+
+void compress_wake_all() { 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        if(page_attributes[page] & PAGE_COMPRESSED) compress_fault(page); 
+    }
+}
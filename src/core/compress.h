@@ -0,0 +1,46 @@
+#ifndef _COMPRESS
+#define _COMPRESS
+
+#include<stdint.h>
+#include<stddef.h>
+
+#include "image-cache.h"
+
+/*
+ * Idle memory compression ( lc3 --compress-idle=MS ).
+ *
+ * When GETC / IN has waited MS milliseconds for a key, every plain page of memory[] is
+ * compressed and gets the PAGE_COMPRESSED attribute :
+ *   - a page of zeros keeps nothing
+ *   - a page still equal to a loaded image keeps nothing either, it is rebuilt from the
+ *     image cache entry ( see compress_baseline() )
+ *   - anything else is LZ coded on words : literals, runs of equal or evenly spaced words
+ *     and copies from earlier in the page, kept only when smaller than the page
+ * Host pages ( 8 guest pages ) whose guest pages are all compressed are handed back to
+ * the kernel with madvise(MADV_DONTNEED).
+ *
+ * The first mem_read() / mem_write() of a compressed page goes through the slow path and
+ * decompresses it ( compress_fault() ), so the guest wakes one page at a time.
+ */
+enum { 
+    COMPRESS_MAX_BASELINES = 16,
+}; 
+
+struct compress_stats { 
+    uint64_t compressed_pages;        // currently compressed
+    uint64_t zero_pages; 
+    uint64_t image_pages; 
+    uint64_t stored_bytes;            // LZ data currently held
+    uint64_t released_bytes;          // host memory handed back by the last pass
+    uint64_t wakes;                   // pages decompressed so far
+}; 
+
+int compress_idle_ms;                 // 0 = off
+struct compress_stats compress_stats; 
+
+void compress_baseline(const struct cached_image* image); 
+void compress_memory(); 
+void compress_fault(uint16_t page); 
+void compress_wake_all(); 
+
+#endif
@@ -1,19 +1,21 @@
 #include "core.h"
+#include "keyboard.h"
+#include "checkpoint.h"
+#include "trace.h"
+#include "debug.h"
+#include "profile.h"
+#include "compress.h"
+#include "disk.h"
+#include "../hot-trace.h"
 
 #include<stdio.h> 
-#include<unistd.h> 
-#include<sys/time.h> 
-
-uint16_t check_key() { 
-    fd_set readfds; 
-    FD_ZERO(&readfds); 
-    FD_SET(STDIN_FILENO, &readfds); 
-    struct timeval timeout ; 
-    timeout.tv_sec =0 ; 
-    timeout.tv_usec = 0  ; 
-    return select(1, &readfds, NULL, NULL, &timeout) != 0 ; 
+#include<time.h> 
 
-}
+uint16_t* memory = machine_memory; 
+
+uint8_t page_attributes[PAGE_COUNT] = { 
+    [MR_KBSR >> PAGE_SHIFT] = PAGE_DEVICE, 
+};
 
 
 /* 
@@ -30,7 +32,7 @@ void update_flags(uint16_t r) {
 
     }else if (registers[r] >> 15) 
     { 
-        registers[R_COND] >> FL_NEG; 
+        registers[R_COND] = FL_NEG; 
     }else { 
         registers[R_COND]  = FL_POS;
     }
@@ -38,22 +40,106 @@ void update_flags(uint16_t r) {
 
 
 
-// Memory Access ( write )
-void mem_write(uint16_t address, uint16_t val) {
-    memory[address] = val; 
+static void store32(uint16_t address, uint32_t value) { 
+    memory[address] = value & 0xFFFF; 
+    memory[address + 1] = value >> 16; 
 }
 
+// snapshot every performance counter into the device page
+static void perf_latch() { 
+    struct timespec now; 
+    clock_gettime(CLOCK_MONOTONIC, &now); 
+    uint64_t clock = (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec; 
+    store32(MR_ICNT_LO, (uint32_t) instructions_retired); 
+    store32(MR_CLOCK_0, (uint32_t) clock); 
+    store32(MR_CLOCK_2, (uint32_t) (clock >> 32)); 
+    store32(MR_LOADS_LO, perf_counters[PERF_LOADS]); 
+    store32(MR_STORES_LO, perf_counters[PERF_STORES]); 
+    store32(MR_BRANCHES_LO, perf_counters[PERF_BRANCHES]); 
+    store32(MR_TRAPS_LO, perf_counters[PERF_TRAPS]); 
+}
 
-// Memory Access ( read )
-uint16_t mem_read(uint16_t address) { 
+// slow paths : only taken for pages with attributes
+static void mem_write_slow(uint16_t address, uint16_t val) { 
+    uint8_t attributes = page_attributes[address >> PAGE_SHIFT]; 
+    if(attributes & PAGE_LAZY) { 
+        checkpoint_fault(address >> PAGE_SHIFT); 
+    }
+    if(attributes & PAGE_COMPRESSED) { 
+        compress_fault(address >> PAGE_SHIFT); 
+    }
+    if(attributes & PAGE_TRACE) { 
+        trace_memory(address, val, TRACE_STORE); 
+    }
+    if(attributes & PAGE_PROFILE) { 
+        profile_access(address, PROFILE_WRITE); 
+    }
+    if(attributes & (PAGE_BREAKPOINT | PAGE_WATCH)) { 
+        if(debug_write(address, val)) return; 
+    }
+    if(attributes & PAGE_CODE) { 
+        hot_invalidate(address); 
+    }
+    // performance counters are read only
+    if((attributes & PAGE_DEVICE) && address >= MR_ICNT_LO && address < MR_PERF_END) return; 
+    // so are the disk status and size, a command starts the transfer
+    if((attributes & PAGE_DEVICE) && address >= MR_DISK_STATUS && address < MR_DISK_END) return; 
+    memory[address] = val; 
+    if((attributes & PAGE_DEVICE) && address == MR_DISK_COMMAND) disk_command(val); 
+}
+
+static uint16_t mem_read_slow(uint16_t address) { 
+    uint8_t attributes = page_attributes[address >> PAGE_SHIFT]; 
+    if(attributes & PAGE_LAZY) { 
+        checkpoint_fault(address >> PAGE_SHIFT); 
+    }
+    if(attributes & PAGE_COMPRESSED) { 
+        compress_fault(address >> PAGE_SHIFT); 
+    }
     if(address == MR_KBSR) { 
-        if(check_key()) { 
+        if(keyboard_poll()) { 
             memory[MR_KBSR] = ( 1 << 15 ); 
-            memory[MR_KBDR] = getchar() ; 
+            memory[MR_KBDR] = keyboard_getchar() ; 
         }
         else { 
             memory[MR_KBSR] = 0 ; 
         }
+        dirty_pages[MR_KBSR >> PAGE_SHIFT] = DIRTY_ALL;
+    }
+    if(address == MR_ICNT_LO) { 
+        perf_counting = 1; 
+        perf_latch(); 
+        dirty_pages[MR_ICNT_LO >> PAGE_SHIFT] = DIRTY_ALL;
+    }
+    uint16_t value = memory[address]; 
+    if(attributes & (PAGE_BREAKPOINT | PAGE_WATCH)) { 
+        value = debug_read(address, value); 
+    }
+    if(attributes & PAGE_TRACE) { 
+        trace_memory(address, value, TRACE_LOAD); 
+    }
+    if(attributes & PAGE_PROFILE) { 
+        profile_access(address, PROFILE_READ); 
+    }
+    return value; 
+}
+
+
+// Memory Access ( write )
+void mem_write(uint16_t address, uint16_t val) {
+    dirty_pages[address >> PAGE_SHIFT] = DIRTY_ALL;
+    if(page_attributes[address >> PAGE_SHIFT]) { 
+        mem_write_slow(address, val); 
+        return; 
+    }
+    memory[address] = val; 
+}
+
+
+// Memory Access ( read )
+uint16_t mem_read(uint16_t address) { 
+    if(page_attributes[address >> PAGE_SHIFT]) { 
+        return mem_read_slow(address); 
     }
     return memory[address]; 
 }
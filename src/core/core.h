@@ -5,7 +5,9 @@
 
 // 65536 memory locations
 // 16 bit memory slots 
-uint16_t memory[UINT16_MAX];
+uint16_t machine_memory[UINT16_MAX + 1];
+// the memory the interpreter runs on : machine_memory, or a VM context's ( see vm-pool.h )
+extern uint16_t* memory;
 
 
 // 16 bit registers
@@ -32,13 +34,120 @@ enum {
 
 uint16_t registers[R_COUNT];
 
+// cleared by HALT ( or by anything that wants the fetch/execute loop to stop )
+// signal handlers clear it too, so it is volatile
+volatile int running;
+
+// set by HALT only
+int halted;
+
+// instructions fetched and executed so far
+uint64_t instructions_retired;
+
+/*
+ * Memory is tracked in pages of 256 words ( 256 pages in total ).
+ * mem_write() sets every bit of the page entry in dirty_pages,
+ * each user of the map owns one bit and clears only that bit.
+ */
+enum {
+    PAGE_SHIFT = 8,
+    PAGE_SIZE  = 1 << PAGE_SHIFT,
+    PAGE_COUNT = 1 << (16 - PAGE_SHIFT),
+};
+
+enum {
+    DIRTY_SNAPSHOT   = 1 << 0, // fuzz snapshot ( see fuzz.c )
+    DIRTY_CHECKPOINT = 1 << 1, // incremental checkpoints ( see checkpoint.c )
+    DIRTY_POOL       = 1 << 2, // written since vm_context_load() ( see vm-pool.c )
+    DIRTY_HLE        = 1 << 3, // targets identified on the page must be looked at again ( see hle.c )
+    DIRTY_ALL        = 0xFF,
+};
+
+uint8_t dirty_pages[PAGE_COUNT];
+
+/*
+ * Page attributes.
+ * Pages with a non zero entry take the slow path of mem_read()/mem_write(),
+ * every other page is a plain array access.
+ */
+enum {
+    PAGE_DEVICE     = 1 << 0, // memory mapped registers
+    PAGE_LAZY       = 1 << 1, // contents still in a checkpoint file, copied in on first access
+    PAGE_TRACE      = 1 << 2, // accesses are recorded by the execution trace
+    PAGE_BREAKPOINT = 1 << 3, // holds a debugger breakpoint
+    PAGE_WATCH      = 1 << 4, // holds ( part of ) a debugger watchpoint
+    PAGE_PROFILE    = 1 << 5, // accesses are counted by the memory profiler
+    PAGE_CODE       = 1 << 6, // holds code of a hot trace, stores drop the trace ( see hot-trace.h )
+    PAGE_COMPRESSED = 1 << 7, // contents compressed while the guest was idle, decompressed on first access
+};
+
+extern uint8_t page_attributes[PAGE_COUNT];
+
 // memory mapped registers
 // used for keyboard device
 enum { 
-    MR_KBSR = 0xFE00;  // keyboard status
-    MR_KBDR = 0xFE02 ; // keyboard data
+    MR_KBSR = 0xFE00,  // keyboard status
+    MR_KBDR = 0xFE02,  // keyboard data
 };
 
+/*
+ * Performance counters ( read only, 32 bit values are low word first ).
+ * Reading MR_ICNT_LO latches every counter, the other words return the latched values,
+ * so read MR_ICNT_LO first and a sequence of reads is consistent.
+ * Loads, stores, branches and traps are counted from the first read of MR_ICNT_LO on, a
+ * guest that never reads the counters costs the handlers one untaken branch.
+ */
+enum { 
+    MR_ICNT_LO = 0xFE10, // retired instructions
+    MR_ICNT_HI, 
+    MR_CLOCK_0,          // host clock in nanoseconds ( 64 bit )
+    MR_CLOCK_1, 
+    MR_CLOCK_2, 
+    MR_CLOCK_3, 
+    MR_LOADS_LO,         // LD / LDI / LDR executed
+    MR_LOADS_HI, 
+    MR_STORES_LO,        // ST / STI / STR executed
+    MR_STORES_HI, 
+    MR_BRANCHES_LO,      // taken BR
+    MR_BRANCHES_HI, 
+    MR_TRAPS_LO,         // TRAP executed
+    MR_TRAPS_HI, 
+    MR_PERF_END, 
+};
+
+/*
+ * Block storage device ( lc3 --disk=FILE, see disk.h ).
+ * Writing MR_DISK_COMMAND moves MR_DISK_COUNT sectors between sector MR_DISK_SECTOR
+ * and memory at MR_DISK_ADDRESS, MR_DISK_STATUS and MR_DISK_SIZE are read only.
+ */
+enum { 
+    MR_DISK_SECTOR_LO = 0xFE20, 
+    MR_DISK_SECTOR_HI, 
+    MR_DISK_ADDRESS,     // first word in memory
+    MR_DISK_COUNT,       // sectors to move
+    MR_DISK_COMMAND,     // DISK_READ / DISK_WRITE / DISK_FLUSH, the transfer runs on the write
+    MR_DISK_STATUS,      // DISK_READY, DISK_ERROR
+    MR_DISK_SIZE_LO,     // sectors on the device
+    MR_DISK_SIZE_HI, 
+    MR_DISK_END, 
+};
+
+enum { 
+    PERF_LOADS = 0, 
+    PERF_STORES, 
+    PERF_BRANCHES, 
+    PERF_TRAPS, 
+    PERF_COUNT, 
+};
+
+// load / store / branch / trap counts, only kept once the guest has read MR_ICNT_LO ( perf_counting )
+uint32_t perf_counters[PERF_COUNT]; 
+int perf_counting; 
+
+// traps executed by vector and bytes written to the console ( published by metrics.c )
+uint64_t trap_counts[UINT8_MAX + 1]; 
+uint64_t output_bytes; 
+
 /**
  * 3 Conditional flags
  * ( indicates the sign of previous calculation)
@@ -0,0 +1,195 @@
+#include <stdint.h>
+
+#include "core.h"
+#include "checkpoint.h"
+#include "compress.h"
+#include "debug.h"
+
+static struct { 
+    uint16_t address; 
+    uint16_t original; // the instruction word the breakpoint replaced
+} breakpoints[DEBUG_MAX_BREAKPOINTS]; 
+static int breakpoint_count; 
+
+static struct { 
+    uint16_t address; 
+    uint16_t length; 
+    int kind; 
+} watchpoints[DEBUG_MAX_WATCHPOINTS]; 
+static int watchpoint_count; 
+
+// set by debug_begin(), the first slow path read of PC - 1 after it is the fetch
+static int fetch_pending; 
+
+static int find_breakpoint(uint16_t address) { 
+    for(int i = 0; i < breakpoint_count; ++i) { 
+        if(breakpoints[i].address == address) return i; 
+    }
+    return -1; 
+}
+
+int debug_is_breakpoint(uint16_t address) { 
+    return find_breakpoint(address) >= 0; 
+}
+
+// recompute PAGE_BREAKPOINT / PAGE_WATCH for one page
+static void update_page(uint16_t page) { 
+    uint8_t attributes = page_attributes[page] & ~(PAGE_BREAKPOINT | PAGE_WATCH); 
+    for(int i = 0; i < breakpoint_count; ++i) { 
+        if(breakpoints[i].address >> PAGE_SHIFT == page) attributes |= PAGE_BREAKPOINT; 
+    }
+    for(int i = 0; i < watchpoint_count; ++i) { 
+        uint32_t first = watchpoints[i].address >> PAGE_SHIFT; 
+        uint32_t last = (watchpoints[i].address + watchpoints[i].length - 1) >> PAGE_SHIFT; 
+        if(page >= first && page <= last) attributes |= PAGE_WATCH; 
+    }
+    page_attributes[page] = attributes; 
+}
+
+int debug_insert_breakpoint(uint16_t address) { 
+    if(debug_is_breakpoint(address)) return 1; 
+    if(breakpoint_count == DEBUG_MAX_BREAKPOINTS) return 0; 
+    // make sure a lazily restored ( or compressed ) page is copied in before patching it
+    if(page_attributes[address >> PAGE_SHIFT] & PAGE_LAZY) checkpoint_fault(address >> PAGE_SHIFT); 
+    if(page_attributes[address >> PAGE_SHIFT] & PAGE_COMPRESSED) compress_fault(address >> PAGE_SHIFT); 
+    breakpoints[breakpoint_count].address = address; 
+    breakpoints[breakpoint_count].original = memory[address]; 
+    ++breakpoint_count; 
+    memory[address] = DEBUG_BREAKPOINT; 
+    update_page(address >> PAGE_SHIFT); 
+    return 1; 
+}
+
+// words is a copy of page : put back the instruction words the breakpoints replaced
+void debug_original_words(uint16_t page, uint16_t* words) { 
+    for(int i = 0; i < breakpoint_count; ++i) { 
+        if(breakpoints[i].address >> PAGE_SHIFT == page) words[breakpoints[i].address & (PAGE_SIZE - 1)] = breakpoints[i].original; 
+    }
+}
+
+int debug_remove_breakpoint(uint16_t address) { 
+    int i = find_breakpoint(address); 
+    if(i < 0) return 0; 
+    memory[address] = breakpoints[i].original; 
+    breakpoints[i] = breakpoints[--breakpoint_count]; 
+    update_page(address >> PAGE_SHIFT); 
+    return 1; 
+}
+
+int debug_insert_watchpoint(uint16_t address, uint16_t length, int kind) { 
+    if(watchpoint_count == DEBUG_MAX_WATCHPOINTS || length == 0) return 0; 
+    watchpoints[watchpoint_count].address = address; 
+    watchpoints[watchpoint_count].length = length; 
+    watchpoints[watchpoint_count].kind = kind; 
+    ++watchpoint_count; 
+    for(uint32_t page = address >> PAGE_SHIFT; page <= (uint32_t) (address + length - 1) >> PAGE_SHIFT; ++page) { 
+        update_page(page); 
+    }
+    return 1; 
+}
+
+int debug_remove_watchpoint(uint16_t address, uint16_t length, int kind) { 
+    for(int i = 0; i < watchpoint_count; ++i) { 
+        if(watchpoints[i].address == address && watchpoints[i].length == length && watchpoints[i].kind == kind) { 
+            watchpoints[i] = watchpoints[--watchpoint_count]; 
+            for(uint32_t page = address >> PAGE_SHIFT; page <= (uint32_t) (address + length - 1) >> PAGE_SHIFT; ++page) { 
+                update_page(page); 
+            }
+            return 1; 
+        }
+    }
+    return 0; 
+}
+
+void debug_remove_all() { 
+    while(breakpoint_count) { 
+        debug_remove_breakpoint(breakpoints[0].address); 
+    }
+    while(watchpoint_count) { 
+        debug_remove_watchpoint(watchpoints[0].address, watchpoints[0].length, watchpoints[0].kind); 
+    }
+}
+
+/*
+ * Called before fetchExecute() while a debugger is attached. A fetch from a plain page
+ * leaves fetch_pending set, a later read of the same word would be on that plain page too.
+ */
+void debug_begin() { 
+    fetch_pending = 1; 
+}
+
+// RTI was fetched : a breakpoint if one is set there
+int debug_breakpoint_hit() { 
+    uint16_t address = registers[R_PC] - 1; 
+    if(!debug_is_breakpoint(address)) return 0; 
+    // the instruction has not run yet
+    registers[R_PC] = address; 
+    --instructions_retired; 
+    debug_stop = DEBUG_STOP_BREAKPOINT; 
+    running = 0; 
+    return 1; 
+}
+
+static void check_watch(uint16_t address, int kind) { 
+    for(int i = 0; i < watchpoint_count; ++i) { 
+        if((watchpoints[i].kind & kind) && (uint16_t) (address - watchpoints[i].address) < watchpoints[i].length) { 
+            debug_watch_address = address; 
+            debug_watch_kind = watchpoints[i].kind; 
+            debug_stop = DEBUG_STOP_WATCHPOINT; 
+            running = 0; 
+        }
+    }
+}
+
+/*
+ * mem_read() slow path : value is what memory holds.
+ * Guest loads see the original word under a breakpoint, only the fetch ( PC - 1 ) sees RTI.
+ * Fetches do not trigger read watchpoints, a load of the instruction's own word does.
+ */
+uint16_t debug_read(uint16_t address, uint16_t value) { 
+    uint8_t attributes = page_attributes[address >> PAGE_SHIFT]; 
+    if(fetch_pending && address == (uint16_t) (registers[R_PC] - 1)) { 
+        fetch_pending = 0; 
+        return value; 
+    }
+    if(attributes & PAGE_BREAKPOINT) { 
+        int i = find_breakpoint(address); 
+        if(i >= 0) value = breakpoints[i].original; 
+    }
+    if(attributes & PAGE_WATCH) check_watch(address, WATCH_READ); 
+    return value; 
+}
+
+// mem_write() slow path : returns 1 when the store went to a breakpoint's saved word instead of memory
+int debug_write(uint16_t address, uint16_t val) { 
+    uint8_t attributes = page_attributes[address >> PAGE_SHIFT]; 
+    if(attributes & PAGE_WATCH) check_watch(address, WATCH_WRITE); 
+    if(attributes & PAGE_BREAKPOINT) { 
+        int i = find_breakpoint(address); 
+        if(i >= 0) { 
+            breakpoints[i].original = val; 
+            return 1; 
+        }
+    }
+    return 0; 
+}
+
+// debugger view of memory : no device side effects, original words under breakpoints
+uint16_t debug_peek(uint16_t address) { 
+    if(page_attributes[address >> PAGE_SHIFT] & PAGE_LAZY) checkpoint_fault(address >> PAGE_SHIFT); 
+    if(page_attributes[address >> PAGE_SHIFT] & PAGE_COMPRESSED) compress_fault(address >> PAGE_SHIFT); 
+    int i = find_breakpoint(address); 
+    return i >= 0 ? breakpoints[i].original : memory[address]; 
+}
+
+void debug_poke(uint16_t address, uint16_t val) { 
+    if(page_attributes[address >> PAGE_SHIFT] & PAGE_LAZY) checkpoint_fault(address >> PAGE_SHIFT); 
+    if(page_attributes[address >> PAGE_SHIFT] & PAGE_COMPRESSED) compress_fault(address >> PAGE_SHIFT); 
+    dirty_pages[address >> PAGE_SHIFT] = DIRTY_ALL; 
+    int i = find_breakpoint(address); 
+    if(i >= 0) { 
+        breakpoints[i].original = val; 
+    }else { 
+        memory[address] = val; 
+    }
+}
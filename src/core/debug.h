@@ -0,0 +1,56 @@
+#ifndef _DEBUG
+#define _DEBUG
+
+#include<stdint.h> 
+
+/*
+ * Breakpoints and watchpoints ( used by the gdb stub ).
+ *
+ * A breakpoint replaces the instruction word with DEBUG_BREAKPOINT ( RTI, which has no
+ * other use in this machine ), so the interpreter only notices it when it gets there.
+ * The page gets PAGE_BREAKPOINT so guest loads and stores still see the original word, and
+ * checkpoints save it ( debug_original_words() ).
+ * Watchpoints mark their pages PAGE_WATCH and are checked on the mem_read()/mem_write() slow path.
+ * A hit clears running and sets debug_stop, the fetch/execute loop is left after the instruction.
+ */
+enum { 
+    DEBUG_BREAKPOINT       = 0x8000, // RTI
+    DEBUG_MAX_BREAKPOINTS  = 64, 
+    DEBUG_MAX_WATCHPOINTS  = 16, 
+};
+
+// watchpoint kinds
+enum { 
+    WATCH_WRITE  = 1 << 0, 
+    WATCH_READ   = 1 << 1, 
+    WATCH_ACCESS = WATCH_WRITE | WATCH_READ, 
+};
+
+// why the loop stopped
+enum { 
+    DEBUG_STOP_NONE = 0, 
+    DEBUG_STOP_BREAKPOINT, 
+    DEBUG_STOP_WATCHPOINT, 
+    DEBUG_STOP_INTERRUPT, 
+};
+
+volatile int debug_stop; 
+uint16_t debug_watch_address; // address that triggered the watchpoint
+int debug_watch_kind; 
+
+int debug_insert_breakpoint(uint16_t address); 
+int debug_remove_breakpoint(uint16_t address); 
+int debug_is_breakpoint(uint16_t address); 
+int debug_insert_watchpoint(uint16_t address, uint16_t length, int kind); 
+int debug_remove_watchpoint(uint16_t address, uint16_t length, int kind); 
+void debug_remove_all(); 
+int debug_breakpoint_hit(); 
+void debug_begin(); 
+void debug_original_words(uint16_t page, uint16_t* words); 
+
+uint16_t debug_read(uint16_t address, uint16_t value); 
+int debug_write(uint16_t address, uint16_t val); 
+uint16_t debug_peek(uint16_t address); 
+void debug_poke(uint16_t address, uint16_t val); 
+
+#endif
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "core.h"
+#include "disk.h"
+#include "checkpoint.h"
+
+static uint8_t* device; 
+static size_t device_bytes; 
+static uint32_t sectors; 
+static int opened; 
+static int writable; 
+// a transfer into the device page may store to MR_DISK_COMMAND again, that store is ignored
+static int busy; 
+
+static uint32_t page_left(uint16_t address) { 
+    return PAGE_SIZE - (address & (PAGE_SIZE - 1)); 
+}
+
+static uint32_t min32(uint32_t a, uint32_t b) { 
+    return a < b ? a : b; 
+}
+
+int disk_open(const char* path) { 
+    writable = 1; 
+    int fd = open(path, O_RDWR); 
+    if(fd < 0) { 
+        writable = 0; 
+        fd = open(path, O_RDONLY); 
+    }
+    if(fd < 0) return 0; 
+    struct stat status; 
+    if(fstat(fd, &status) != 0) { 
+        close(fd); 
+        return 0; 
+    }
+    sectors = status.st_size / DISK_SECTOR_BYTES; 
+    device_bytes = (size_t) sectors * DISK_SECTOR_BYTES; 
+    if(device_bytes) { 
+        device = mmap(NULL, device_bytes, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0); 
+        if(device == MAP_FAILED) { 
+            device = NULL; 
+            close(fd); 
+            return 0; 
+        }
+        madvise(device, device_bytes, MADV_SEQUENTIAL); 
+    }
+    close(fd); 
+    opened = 1; 
+    // a restored device page is copied in first, it would overwrite the registers on the next access
+    uint16_t page = MR_DISK_STATUS >> PAGE_SHIFT; 
+    if(page_attributes[page] & PAGE_LAZY) checkpoint_fault(page); 
+    memory[MR_DISK_STATUS] = DISK_READY; 
+    memory[MR_DISK_SIZE_LO] = sectors & 0xFFFF; 
+    memory[MR_DISK_SIZE_HI] = sectors >> 16; 
+    dirty_pages[page] = DIRTY_ALL; 
+    return 1; 
+}
+
+void disk_close() { 
+    opened = 0; 
+    if(!device) return; 
+    if(writable) msync(device, device_bytes, MS_SYNC); 
+    munmap(device, device_bytes); 
+    device = NULL; 
+}
+
+// big endian device words into memory, one page of memory at a time
+static void to_memory(uint16_t address, const uint8_t* bytes, uint32_t words) { 
+    while(words) { 
+        uint32_t run = min32(words, page_left(address)); 
+        if(page_attributes[address >> PAGE_SHIFT]) { 
+            for(uint32_t i = 0; i < run; ++i) { 
+                mem_write(address + i, bytes[2 * i] << 8 | bytes[2 * i + 1]); 
+            }
+        }else { 
+            uint16_t* out = memory + address; 
+            for(uint32_t i = 0; i < run; ++i) out[i] = bytes[2 * i] << 8 | bytes[2 * i + 1]; 
+            dirty_pages[address >> PAGE_SHIFT] = DIRTY_ALL; 
+        }
+        address += run; 
+        bytes += 2 * run; 
+        words -= run; 
+    }
+}
+
+static void from_memory(uint16_t address, uint8_t* bytes, uint32_t words) { 
+    while(words) { 
+        uint32_t run = min32(words, page_left(address)); 
+        if(page_attributes[address >> PAGE_SHIFT]) { 
+            for(uint32_t i = 0; i < run; ++i) { 
+                uint16_t value = mem_read(address + i); 
+                bytes[2 * i] = value >> 8; 
+                bytes[2 * i + 1] = value & 0xFF; 
+            }
+        }else { 
+            const uint16_t* in = memory + address; 
+            for(uint32_t i = 0; i < run; ++i) { 
+                bytes[2 * i] = in[i] >> 8; 
+                bytes[2 * i + 1] = in[i] & 0xFF; 
+            }
+        }
+        address += run; 
+        bytes += 2 * run; 
+        words -= run; 
+    }
+}
+
+// called from the mem_write() slow path after the command word is stored
+void disk_command(uint16_t command) { 
+    if(busy) return; 
+    busy = 1; 
+    uint32_t sector = memory[MR_DISK_SECTOR_LO] | (uint32_t) memory[MR_DISK_SECTOR_HI] << 16; 
+    uint16_t address = memory[MR_DISK_ADDRESS]; 
+    uint32_t count = memory[MR_DISK_COUNT]; 
+    uint16_t status = DISK_READY; 
+
+    if(!opened) { 
+        status |= DISK_ERROR; 
+    }else if(command == DISK_FLUSH) { 
+        if(device && writable && msync(device, device_bytes, MS_SYNC) != 0) status |= DISK_ERROR; 
+    }else if((command != DISK_READ && command != DISK_WRITE) || (uint64_t) sector + count > sectors
+            || (command == DISK_WRITE && !writable)) { 
+        status |= DISK_ERROR; 
+    }else { 
+        uint8_t* bytes = device + (size_t) sector * DISK_SECTOR_BYTES; 
+        // memory is only 256 sectors long, longer transfers wrap and keep going
+        if(command == DISK_READ) to_memory(address, bytes, count * DISK_SECTOR_WORDS); 
+        else from_memory(address, bytes, count * DISK_SECTOR_WORDS); 
+    }
+    memory[MR_DISK_STATUS] = status; 
+    dirty_pages[MR_DISK_STATUS >> PAGE_SHIFT] = DIRTY_ALL; 
+    busy = 0; 
+}
@@ -0,0 +1,39 @@
+#ifndef _DISK
+#define _DISK
+
+#include<stdint.h>
+
+/*
+ * Block storage device.
+ *
+ * The host file is mmap'd, sector n is bytes n * 512 up to n * 512 + 511, words big endian
+ * like an image file. A trailing partial sector is not part of the device.
+ *
+ * A guest sets MR_DISK_SECTOR_LO / _HI, MR_DISK_ADDRESS and MR_DISK_COUNT, writes a command
+ * to MR_DISK_COMMAND and polls MR_DISK_STATUS for DISK_READY. Transfers complete before the
+ * store to MR_DISK_COMMAND retires, whole pages of memory[] are copied with one loop over
+ * the host words ( pages with attributes still go through mem_read() / mem_write() ).
+ * Memory wraps from xFFFF to x0000. A transfer past the end of the device does nothing and
+ * sets DISK_ERROR, so does any command without a device.
+ */
+enum { 
+    DISK_SECTOR_WORDS = 256,
+    DISK_SECTOR_BYTES = DISK_SECTOR_WORDS * 2,
+}; 
+
+enum { 
+    DISK_READ  = 1,          // device to memory
+    DISK_WRITE = 2,          // memory to device
+    DISK_FLUSH = 3,          // msync() the file
+}; 
+
+enum { 
+    DISK_READY = 1 << 15,
+    DISK_ERROR = 1 << 0,
+}; 
+
+int disk_open(const char* path); 
+void disk_close(); 
+void disk_command(uint16_t command); 
+
+#endif
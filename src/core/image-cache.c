@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+
+#include "bit-utilities.h"
+#include "image-cache.h"
+
+enum { 
+    MAX_IMAGE_BYTES = sizeof(uint16_t) * (UINT16_MAX + 2), // origin + a full memory
+}; 
+
+struct image_entry { 
+    struct cached_image image;        // first, release() casts back
+    struct image_entry* next; 
+    _Atomic uint64_t last_use; 
+    _Atomic uint32_t users; 
+    size_t bytes; 
+}; 
+
+// what stat() said the last time a file was read, and the hash of what it held
+struct image_file { 
+    struct image_file* next; 
+    dev_t device; 
+    ino_t inode; 
+    off_t size; 
+    struct timespec modified; 
+    uint64_t hash; 
+}; 
+
+static struct image_entry* images[IMAGE_CACHE_BUCKETS]; 
+static struct image_file* files[IMAGE_CACHE_BUCKETS]; 
+static size_t cached_bytes; 
+static _Atomic uint64_t use_clock; 
+static pthread_rwlock_t cache_lock = PTHREAD_RWLOCK_INITIALIZER; 
+
+static uint64_t hash_bytes(const uint8_t* bytes, size_t count) { 
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ull; 
+    uint64_t hash = count * multiplier; 
+    size_t i = 0; 
+    for(; i + 8 <= count; i += 8) { 
+        uint64_t value; 
+        memcpy(&value, bytes + i, sizeof(value)); 
+        hash = (hash ^ value) * multiplier; 
+        hash ^= hash >> 29; 
+    }
+    for(; i < count; ++i) { 
+        hash = (hash ^ bytes[i]) * multiplier; 
+    }
+    hash ^= hash >> 32; 
+    return hash; 
+}
+
+static size_t file_bucket(const struct stat* status) { 
+    return ((uint64_t) status->st_dev * 31 + (uint64_t) status->st_ino) % IMAGE_CACHE_BUCKETS; 
+}
+
+static struct image_file* find_file(const struct stat* status) { 
+    for(struct image_file* file = files[file_bucket(status)]; file; file = file->next) { 
+        if(file->device == status->st_dev && file->inode == status->st_ino) return file; 
+    }
+    return NULL; 
+}
+
+static int file_unchanged(const struct image_file* file, const struct stat* status) { 
+    return file->size == status->st_size
+        && file->modified.tv_sec == status->st_mtim.tv_sec
+        && file->modified.tv_nsec == status->st_mtim.tv_nsec; 
+}
+
+static struct image_entry* find_image(uint64_t hash) { 
+    for(struct image_entry* entry = images[hash % IMAGE_CACHE_BUCKETS]; entry; entry = entry->next) { 
+        if(entry->image.hash == hash) return entry; 
+    }
+    return NULL; 
+}
+
+static void use(struct image_entry* entry) { 
+    atomic_fetch_add(&entry->users, 1); 
+    atomic_store_explicit(&entry->last_use, atomic_fetch_add(&use_clock, 1), memory_order_relaxed); 
+}
+
+// drop an entry and every file pointing at it, called with the lock held exclusively
+static void evict(struct image_entry* victim) { 
+    struct image_entry** link = &images[victim->image.hash % IMAGE_CACHE_BUCKETS]; 
+    while(*link != victim) link = &(*link)->next; 
+    *link = victim->next; 
+    for(int bucket = 0; bucket < IMAGE_CACHE_BUCKETS; ++bucket) { 
+        struct image_file** file = &files[bucket]; 
+        while(*file) { 
+            if((*file)->hash == victim->image.hash) { 
+                struct image_file* dropped = *file; 
+                *file = dropped->next; 
+                free(dropped); 
+            }else { 
+                file = &(*file)->next; 
+            }
+        }
+    }
+    cached_bytes -= victim->bytes; 
+    free(victim); 
+}
+
+static void trim(const struct image_entry* keep) { 
+    size_t limit = image_cache_limit ? image_cache_limit : IMAGE_CACHE_DEFAULT_LIMIT; 
+    while(cached_bytes > limit) { 
+        struct image_entry* oldest = NULL; 
+        for(int bucket = 0; bucket < IMAGE_CACHE_BUCKETS; ++bucket) { 
+            for(struct image_entry* entry = images[bucket]; entry; entry = entry->next) { 
+                if(entry == keep || atomic_load(&entry->users)) continue; 
+                if(!oldest || atomic_load(&entry->last_use) < atomic_load(&oldest->last_use)) oldest = entry; 
+            }
+        }
+        if(!oldest) return; 
+        evict(oldest); 
+    }
+}
+
+/*
+ * Same layout as read_image_file() : big endian origin, then words up to xFFFF,
+ * anything after that and an odd last byte are ignored.
+ */
+static struct image_entry* read_entry(const char* image_path) { 
+    FILE* file = fopen(image_path, "rb"); 
+    if(!file) return NULL; 
+    uint8_t* bytes = malloc(MAX_IMAGE_BYTES); 
+    if(!bytes) { 
+        fclose(file); 
+        return NULL; 
+    }
+    size_t count = fread(bytes, 1, MAX_IMAGE_BYTES, file); 
+    fclose(file); 
+
+    uint16_t origin = 0; 
+    uint32_t length = 0; 
+    if(count >= sizeof(uint16_t)) { 
+        origin = bytes[0] << 8 | bytes[1]; 
+        length = (count - sizeof(uint16_t)) / sizeof(uint16_t); 
+        if(length > (uint32_t) (UINT16_MAX + 1) - origin) length = (uint32_t) (UINT16_MAX + 1) - origin; 
+    }
+
+    size_t words_bytes = length * sizeof(uint16_t); 
+    struct image_entry* entry = malloc(sizeof(*entry) + words_bytes); 
+    if(!entry) { 
+        free(bytes); 
+        return NULL; 
+    }
+    uint16_t* words = (uint16_t*) (entry + 1); 
+    memcpy(words, bytes + sizeof(uint16_t), words_bytes); 
+    for(uint32_t i = 0; i < length; ++i) words[i] = swap16(words[i]); 
+
+    entry->image.hash = hash_bytes(bytes, sizeof(uint16_t) + words_bytes); 
+    entry->image.origin = origin; 
+    entry->image.length = length; 
+    entry->image.words = words; 
+    entry->next = NULL; 
+    atomic_init(&entry->last_use, 0); 
+    atomic_init(&entry->users, 0); 
+    entry->bytes = sizeof(*entry) + words_bytes; 
+    free(bytes); 
+    return entry; 
+}
+
+const struct cached_image* image_cache_acquire(const char* image_path) { 
+    struct stat status; 
+    if(stat(image_path, &status) != 0) return NULL; 
+
+    pthread_rwlock_rdlock(&cache_lock); 
+    const struct image_file* file = find_file(&status); 
+    struct image_entry* entry = file && file_unchanged(file, &status) ? find_image(file->hash) : NULL; 
+    if(entry) use(entry); 
+    pthread_rwlock_unlock(&cache_lock); 
+    if(entry) { 
+        __atomic_fetch_add(&image_cache_hits, 1, __ATOMIC_RELAXED); 
+        return &entry->image; 
+    }
+
+    // the file is read without the lock, another thread may insert the same contents meanwhile
+    struct image_entry* loaded = read_entry(image_path); 
+    if(!loaded) return NULL; 
+    __atomic_fetch_add(&image_cache_misses, 1, __ATOMIC_RELAXED); 
+
+    pthread_rwlock_wrlock(&cache_lock); 
+    entry = find_image(loaded->image.hash); 
+    if(entry && (entry->image.origin != loaded->image.origin || entry->image.length != loaded->image.length
+            || memcmp(entry->image.words, loaded->image.words, loaded->image.length * sizeof(uint16_t)) != 0)) { 
+        // hash collision : keep the cached one, hand out the fresh copy uncached
+        pthread_rwlock_unlock(&cache_lock); 
+        atomic_init(&loaded->users, 1); 
+        loaded->bytes = 0; 
+        return &loaded->image; 
+    }
+    if(entry) { 
+        free(loaded); 
+    }else { 
+        entry = loaded; 
+        struct image_entry** bucket = &images[entry->image.hash % IMAGE_CACHE_BUCKETS]; 
+        entry->next = *bucket; 
+        *bucket = entry; 
+        cached_bytes += entry->bytes; 
+    }
+    use(entry); 
+
+    struct image_file* known = find_file(&status); 
+    if(!known) { 
+        known = malloc(sizeof(*known)); 
+        if(known) { 
+            known->device = status.st_dev; 
+            known->inode = status.st_ino; 
+            known->next = files[file_bucket(&status)]; 
+            files[file_bucket(&status)] = known; 
+        }
+    }
+    if(known) { 
+        known->size = status.st_size; 
+        known->modified = status.st_mtim; 
+        known->hash = entry->image.hash; 
+    }
+    trim(entry); 
+    pthread_rwlock_unlock(&cache_lock); 
+    return &entry->image; 
+}
+
+void image_cache_release(const struct cached_image* image) { 
+    struct image_entry* entry = (struct image_entry*) image; 
+    // uncached copies ( see the collision case ) have no bytes accounted, read before letting go
+    int uncached = entry->bytes == 0; 
+    if(atomic_fetch_sub(&entry->users, 1) == 1 && uncached) free(entry); 
+}
+
+int image_cache_load(const char* image_path, uint16_t memory[]) { 
+    printf("READ IMAGE\n"); 
+    const struct cached_image* image = image_cache_acquire(image_path); 
+    if(!image) return 0; 
+    memcpy(memory + image->origin, image->words, image->length * sizeof(uint16_t)); 
+    image_cache_release(image); 
+    return 1; 
+}
@@ -0,0 +1,47 @@
+#ifndef _IMAGE_CACHE
+#define _IMAGE_CACHE
+
+#include<stdint.h>
+#include<stddef.h>
+
+/*
+ * Image cache.
+ *
+ * Loaded images are kept in process, byte swapped, keyed by a hash of the file contents.
+ * A second table maps ( device, inode, size, mtime ) to that hash, so loading a known file
+ * again costs one stat(), two lookups and a copy of the image words into memory[].
+ * Different files with the same contents share one entry.
+ *
+ * Entries are read only once published and may be used by any thread : lookups take the
+ * lock shared, misses read the file without the lock and take it exclusively to insert.
+ * When the cached words exceed image_cache_limit bytes the least recently used entries
+ * nobody holds are dropped.
+ *
+ * Only the raw words are kept. A hit still copies them into memory[], the cache does not
+ * map its pages into a VM and keeps no decoded form ( the interpreter decodes at every
+ * fetch, it has none to keep ). It pays off where one process loads an image many times :
+ * contexts of vm-pool.c ( vm_context_load_image() ) and the baselines of compress.c. A
+ * single lc3 run reads every image once and saves nothing measurable.
+ */
+enum { 
+    IMAGE_CACHE_BUCKETS       = 256,
+    IMAGE_CACHE_DEFAULT_LIMIT = 32 << 20,
+}; 
+
+struct cached_image { 
+    uint64_t hash;                    // of the file contents, origin included
+    uint16_t origin; 
+    uint32_t length;                  // words at origin
+    const uint16_t* words;            // host byte order
+}; 
+
+size_t image_cache_limit;             // 0 = IMAGE_CACHE_DEFAULT_LIMIT
+uint64_t image_cache_hits; 
+uint64_t image_cache_misses; 
+
+const struct cached_image* image_cache_acquire(const char* image_path); 
+void image_cache_release(const struct cached_image* image); 
+// read_image() through the cache
+int image_cache_load(const char* image_path, uint16_t memory[]); 
+
+#endif
@@ -17,7 +17,7 @@ void disable_input_buffering() {
 }
 
 void restore_input_buffering() { 
-    tcgetattr(STDIN_FILENO, TCSANOW, &original_tio);
+    tcsetattr(STDIN_FILENO, TCSANOW, &original_tio);
 }
 
 void handle_interrupt(int signal) { 
@@ -0,0 +1,161 @@
+#include "core.h"
+#include "keyboard.h"
+#include "metrics.h"
+#include "compress.h"
+
+#include<stdio.h> 
+#include<stdlib.h> 
+#include<unistd.h> 
+#include<errno.h> 
+#include<poll.h> 
+#include<time.h> 
+#include<sys/time.h> 
+
+// input buffer used when keyboard_source == KB_BUFFER
+static const uint8_t* buffer; 
+static size_t buffer_size; 
+static size_t buffer_pos; 
+
+// events of a recorded session ( KB_REPLAY )
+static struct keyboard_event* events; 
+static size_t event_count; 
+static size_t event_pos; 
+
+// session being recorded, NULL when not recording
+static FILE* record_file; 
+static int polled; // last poll said a character is waiting
+
+static uint16_t check_key() { 
+    fd_set readfds; 
+    FD_ZERO(&readfds); 
+    FD_SET(STDIN_FILENO, &readfds); 
+    struct timeval timeout ; 
+    timeout.tv_sec =0 ; 
+    timeout.tv_usec = 0  ; 
+    // -1 ( EINTR from the metrics timer ) is no key either
+    return select(1, &readfds, NULL, NULL, &timeout) > 0 ; 
+
+}
+
+void keyboard_set_buffer(const uint8_t* data, size_t size) { 
+    buffer = data; 
+    buffer_size = size; 
+    buffer_pos = 0; 
+}
+
+static void record(uint16_t character, uint16_t kind) { 
+    struct keyboard_event event = { instructions_retired, character, kind, 0 }; 
+    fwrite(&event, sizeof(event), 1, record_file); 
+    fflush(record_file); 
+}
+
+int keyboard_record(const char* path) { 
+    record_file = fopen(path, "wb"); 
+    return record_file != NULL; 
+}
+
+int keyboard_replay(const char* path) { 
+    FILE* file = fopen(path, "rb"); 
+    if(!file) return 0; 
+    fseek(file, 0, SEEK_END); 
+    long size = ftell(file); 
+    fseek(file, 0, SEEK_SET); 
+    event_count = size / sizeof(struct keyboard_event); 
+    events = malloc(event_count * sizeof(struct keyboard_event)); 
+    size_t read = fread(events, sizeof(struct keyboard_event), event_count, file); 
+    fclose(file); 
+    if(read != event_count) return 0; 
+    event_pos = 0; 
+    keyboard_source = KB_REPLAY; 
+    return 1; 
+}
+
+// the session ends : write the end marker
+void keyboard_close() { 
+    if(record_file) { 
+        record(0, KB_EVENT_END); 
+        fclose(record_file); 
+        record_file = NULL; 
+    }
+}
+
+// replay ran out of input ( or reached the end of the recorded session )
+static void replay_end() { 
+    running = 0; 
+    halted = 1; 
+}
+
+// is a character waiting ? ( used by KBSR )
+uint16_t keyboard_poll() { 
+    if(keyboard_source == KB_BUFFER) { 
+        // a guest polling an empty buffer would spin forever, stop it instead
+        if(buffer_pos == buffer_size) { 
+            running = 0; 
+            return 0; 
+        }
+        return 1; 
+    }
+    if(keyboard_source == KB_REPLAY) { 
+        if(event_pos == event_count || events[event_pos].kind == KB_EVENT_END) { 
+            if(event_pos == event_count || instructions_retired >= events[event_pos].count) replay_end(); 
+            return 0; 
+        }
+        return events[event_pos].count <= instructions_retired; 
+    }
+    polled = check_key(); 
+    if(!polled) ++keyboard_empty_polls; 
+    return polled; 
+}
+
+static uint64_t elapsed_ms(const struct timespec* start) { 
+    struct timespec now; 
+    clock_gettime(CLOCK_MONOTONIC, &now); 
+    return (uint64_t) (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000; 
+}
+
+/*
+ * --compress-idle : wait up to compress_idle_ms for a key, compress memory if none came.
+ * lc3 makes stdin unbuffered for this, every character not read yet is seen by poll().
+ */
+static void idle_wait(const struct timespec* start) { 
+    for(;;) { 
+        uint64_t waited = elapsed_ms(start); 
+        if(waited >= (uint64_t) compress_idle_ms) { 
+            compress_memory(); 
+            return; 
+        }
+        struct pollfd input = { STDIN_FILENO, POLLIN, 0 }; 
+        int ready = poll(&input, 1, compress_idle_ms - waited); 
+        // EINTR : the metrics timer, keep waiting
+        if(ready > 0 || (ready < 0 && errno != EINTR)) return; 
+    }
+}
+
+// read a character ( used by KBDR, GETC and IN )
+uint16_t keyboard_getchar() { 
+    if(keyboard_source == KB_BUFFER) { 
+        if(buffer_pos == buffer_size) { 
+            running = 0; 
+            return (uint16_t) EOF; 
+        }
+        return buffer[buffer_pos++]; 
+    }
+    if(keyboard_source == KB_REPLAY) { 
+        if(event_pos == event_count || events[event_pos].kind == KB_EVENT_END) { 
+            replay_end(); 
+            return (uint16_t) EOF; 
+        }
+        return events[event_pos++].character; 
+    }
+    struct timespec start, end; 
+    clock_gettime(CLOCK_MONOTONIC, &start); 
+    metrics_input_wait(1); 
+    if(compress_idle_ms) idle_wait(&start); 
+    uint16_t character = (uint16_t) getchar(); 
+    metrics_input_wait(0); 
+    clock_gettime(CLOCK_MONOTONIC, &end); 
+    keyboard_blocked_ns += (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000 + end.tv_nsec - start.tv_nsec; 
+    if(record_file) record(character, polled ? KB_EVENT_KBSR : KB_EVENT_GETC); 
+    polled = 0; 
+    return character; 
+}
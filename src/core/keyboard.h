@@ -0,0 +1,50 @@
+#ifndef _KEYBOARD
+#define _KEYBOARD
+
+#include<stdint.h> 
+#include<stddef.h> 
+
+/*
+ * Where keyboard input comes from.
+ * KB_TERMINAL : stdin ( normal interactive use )
+ * KB_BUFFER   : an in-memory buffer ( fuzzing, no terminal attached )
+ * KB_REPLAY   : a recorded session, every character shows up at the instruction it did when recorded
+ */
+enum { 
+    KB_TERMINAL = 0, 
+    KB_BUFFER, 
+    KB_REPLAY, 
+};
+
+int keyboard_source; 
+
+/*
+ * Recorded sessions.
+ * A file of keyboard_event records, one per character handed to the guest,
+ * the last one is KB_EVENT_END with the instruction count the session ended at.
+ */
+enum { 
+    KB_EVENT_KBSR = 0, // seen by polling KBSR
+    KB_EVENT_GETC,     // read by GETC / IN
+    KB_EVENT_END, 
+};
+
+struct keyboard_event { 
+    uint64_t count;      // instructions_retired when the character became visible
+    uint16_t character; 
+    uint16_t kind; 
+    uint32_t unused; 
+};
+
+// KBSR reads that found no character and time spent blocked reading the terminal
+uint64_t keyboard_empty_polls; 
+uint64_t keyboard_blocked_ns; 
+
+void keyboard_set_buffer(const uint8_t* data, size_t size); 
+int keyboard_record(const char* path); 
+int keyboard_replay(const char* path); 
+void keyboard_close(); 
+uint16_t keyboard_poll(); 
+uint16_t keyboard_getchar(); 
+
+#endif
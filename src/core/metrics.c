@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#include "core.h"
+#include "keyboard.h"
+#include "metrics.h"
+
+static struct metrics_page* page; 
+static char segment_name[64]; 
+static timer_t timer; 
+
+// counters at the previous update, for the per second rates
+static uint64_t last_ns; 
+static uint64_t last_instructions; 
+static uint64_t last_polls; 
+
+static uint64_t monotonic_ns() { 
+    struct timespec now; 
+    clock_gettime(CLOCK_MONOTONIC, &now); 
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec; 
+}
+
+static void handle_timer(int signal) { 
+    (void) signal; 
+    metrics_requested = 1; 
+    running = 0; 
+}
+
+int metrics_open() { 
+    snprintf(segment_name, sizeof(segment_name), "/lc3-metrics.%d", (int) getpid()); 
+    int fd = shm_open(segment_name, O_RDWR | O_CREAT | O_TRUNC, 0644); 
+    if(fd < 0) return 0; 
+    if(ftruncate(fd, sizeof(struct metrics_page)) < 0) { 
+        close(fd); 
+        return 0; 
+    }
+    page = mmap(NULL, sizeof(struct metrics_page), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); 
+    close(fd); 
+    if(page == MAP_FAILED) { 
+        page = NULL; 
+        return 0; 
+    }
+    page->magic = METRICS_MAGIC; 
+    page->version = METRICS_VERSION; 
+    page->pid = getpid(); 
+    page->started_ns = last_ns = monotonic_ns(); 
+    last_instructions = instructions_retired; 
+
+    // restarted system calls : a GETC blocked in read() keeps waiting
+    struct sigaction action; 
+    memset(&action, 0, sizeof(action)); 
+    action.sa_handler = handle_timer; 
+    action.sa_flags = SA_RESTART; 
+    sigaction(SIGALRM, &action, NULL); 
+
+    struct sigevent event; 
+    memset(&event, 0, sizeof(event)); 
+    event.sigev_notify = SIGEV_SIGNAL; 
+    event.sigev_signo = SIGALRM; 
+    if(timer_create(CLOCK_MONOTONIC, &event, &timer) < 0) return 0; 
+    struct itimerspec interval = { 
+        { 0, METRICS_INTERVAL_MS * 1000000L }, 
+        { 0, METRICS_INTERVAL_MS * 1000000L }, 
+    }; 
+    timer_settime(timer, 0, &interval, NULL); 
+    metrics_publish(); 
+    return 1; 
+}
+
+void metrics_publish() { 
+    if(!page) return; 
+    uint64_t now = monotonic_ns(); 
+    uint64_t elapsed = now - last_ns; 
+
+    atomic_fetch_add_explicit(&page->sequence, 1, memory_order_relaxed); 
+    atomic_thread_fence(memory_order_release); 
+    page->state = halted ? METRICS_HALTED : METRICS_RUNNING; 
+    page->updated_ns = now; 
+    page->instructions_retired = instructions_retired; 
+    page->output_bytes = output_bytes; 
+    page->empty_polls = keyboard_empty_polls; 
+    page->input_blocked_ns = keyboard_blocked_ns; 
+    page->pc = registers[R_PC]; 
+    if(elapsed) { 
+        page->instructions_per_second = (instructions_retired - last_instructions) * 1000000000 / elapsed; 
+        page->polls_per_second = (keyboard_empty_polls - last_polls) * 1000000000 / elapsed; 
+    }
+    memcpy(page->traps, trap_counts, sizeof(page->traps)); 
+    atomic_thread_fence(memory_order_release); 
+    atomic_fetch_add_explicit(&page->sequence, 1, memory_order_relaxed); 
+
+    last_ns = now; 
+    last_instructions = instructions_retired; 
+    last_polls = keyboard_empty_polls; 
+}
+
+// called around a blocking read of the terminal, visible right away
+void metrics_input_wait(int waiting) { 
+    if(!page) return; 
+    atomic_store_explicit(&page->input_wait_ns, waiting ? monotonic_ns() : 0, memory_order_relaxed); 
+}
+
+// a kept segment outlives the process so readers see its final state, lc3-metrics --remove-stale unlinks it
+void metrics_close() { 
+    if(!page) return; 
+    timer_delete(timer); 
+    metrics_publish(); 
+    munmap(page, sizeof(struct metrics_page)); 
+    page = NULL; 
+    if(!metrics_keep) shm_unlink(segment_name); 
+}
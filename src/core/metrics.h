@@ -0,0 +1,62 @@
+#ifndef _METRICS
+#define _METRICS
+
+#include<stdint.h> 
+#include<stdatomic.h> 
+
+/*
+ * Live metrics.
+ *
+ * A running VM publishes its counters in the shared memory segment /lc3-metrics.PID
+ * ( /dev/shm/lc3-metrics.PID on Linux ), read by src/tools/lc3-metrics.c.
+ * The interpreter only bumps plain counters, a timer clears running every
+ * METRICS_INTERVAL_MS and the main loop copies them out between instructions.
+ * The segment is unlinked at exit. With metrics_keep set ( lc3 --metrics-keep ) it is
+ * left in place with the final counters ( state METRICS_HALTED after a HALT ), until
+ * lc3-metrics --remove-stale unlinks those of processes that are gone.
+ *
+ * Readers use the sequence number : odd while an update is being written,
+ * retry when it is odd or changed during the copy.
+ */
+enum { 
+    METRICS_MAGIC       = 0x4D33434C, // "LC3M"
+    METRICS_VERSION     = 1, 
+    METRICS_INTERVAL_MS = 100, 
+};
+
+enum { 
+    METRICS_RUNNING = 0, 
+    METRICS_HALTED, 
+}; 
+
+struct metrics_page { 
+    uint32_t magic; 
+    uint16_t version; 
+    uint16_t state; 
+    int32_t pid; 
+    _Atomic uint32_t sequence; 
+    uint64_t started_ns;              // CLOCK_MONOTONIC
+    uint64_t updated_ns; 
+    uint64_t instructions_retired; 
+    uint64_t instructions_per_second; // over the last interval
+    uint64_t output_bytes;            // written by OUT / PUTS / PUTSP / IN
+    uint64_t empty_polls;             // KBSR reads without a character
+    uint64_t polls_per_second; 
+    uint64_t input_blocked_ns;        // total time blocked in GETC / IN
+    _Atomic uint64_t input_wait_ns;   // start of the current wait in GETC / IN, 0 when not waiting ( outside the sequence )
+    uint16_t pc; 
+    uint16_t unused[3]; 
+    uint64_t traps[UINT8_MAX + 1];    // by trap vector
+};
+
+// set by the timer, the main loop calls metrics_publish()
+volatile int metrics_requested; 
+// leave the segment behind at exit
+int metrics_keep; 
+
+int metrics_open(); 
+void metrics_publish(); 
+void metrics_input_wait(int waiting); 
+void metrics_close(); 
+
+#endif
@@ -16,6 +16,7 @@ enum {
     OP_LD,     // load
     OP_ST,     // store
     OP_JSR,    // jump register
+    OP_AND,    // bitwise and
     OP_LDR,    // load register
     OP_STR,    // store register
     OP_RTI,    // unused
@@ -23,11 +24,36 @@ enum {
     OP_LDI,    // load indirect
     OP_STI,    // store indirect
     OP_JMP,    // jump 
-    OP_RES,    // reserved( unused )
+    OP_RES,    // reserved( block operations when enabled, see below )
     OP_LEA,    // load effective  address
     OP_TRAP,   // execute trap 
 };
 
+/*
+ * Block operations ( opt in ISA extension, lc3 --block-ops ), encoded in OP_RES :
+ *
+ *  15          Dest    Src     Len     Op   0
+ *  |-------------------------------------------|
+ *  | 1 1 0 1 | D D D | S S S | L L L | O O O   |
+ *  |-------------------------------------------|
+ *
+ *  D D D = register holding the destination address
+ *  S S S = register holding the source address ( MEMSET : the fill value )
+ *  L L L = register holding the length in words
+ *
+ *  BLK_MEMCPY : copy, word by word from the lowest address ( same result as an LDR / STR loop )
+ *  BLK_MEMSET : fill
+ *  BLK_MEMCMP : compare, DR = -1 / 0 / 1 ( unsigned words ) and the condition flags are set
+ *
+ *  Addresses wrap around at xFFFF, the address and length registers are left as they are.
+ *  Without --block-ops the opcode stays reserved.
+ */
+enum { 
+    BLK_MEMCPY = 0, 
+    BLK_MEMSET, 
+    BLK_MEMCMP, 
+};
+
 // Trap codes
 // address in memory that contain trap code : 0x0 to 0x2999
 enum { 
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "core.h"
+#include "profile.h"
+
+struct word_counts { 
+    uint32_t reads; 
+    uint32_t writes; 
+    uint32_t fetches; 
+}; 
+
+// data accesses issued by one PC
+struct stride_counts { 
+    uint32_t accesses; 
+    uint32_t repeats;       // accesses at the same stride as the previous one
+    uint16_t last_address; 
+    int16_t stride; 
+}; 
+
+static const char* output_prefix; 
+static struct word_counts* words; 
+static struct stride_counts* strides; 
+
+// LRU stack of lines, most recent first, and the position of every line in it
+static uint16_t stack[PROFILE_LINES]; 
+static uint16_t stack_position[PROFILE_LINES]; 
+static uint32_t stack_depth; 
+static uint64_t reuse[PROFILE_BUCKETS]; 
+
+int profile_open(const char* prefix) { 
+    words = calloc(UINT16_MAX + 1, sizeof(*words)); 
+    strides = calloc(UINT16_MAX + 1, sizeof(*strides)); 
+    if(!words || !strides) return 0; 
+    output_prefix = prefix; 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        page_attributes[page] |= PAGE_PROFILE; 
+    }
+    return 1; 
+}
+
+// bucket of a stack distance : 0, 1, 2-3, 4-7, ...
+static int bucket(uint32_t distance) { 
+    int n = 0; 
+    while(distance) { 
+        distance >>= 1; 
+        ++n; 
+    }
+    return n; 
+}
+
+static void reuse_access(uint16_t address) { 
+    uint16_t line = address >> PROFILE_LINE_SHIFT; 
+    uint32_t distance; 
+    if(stack_position[line] == 0) { 
+        // first touch ( positions are stored + 1 )
+        distance = stack_depth++; 
+        ++reuse[PROFILE_BUCKETS - 1]; 
+    }else { 
+        distance = stack_position[line] - 1; 
+        ++reuse[bucket(distance)]; 
+    }
+    // move to front
+    for(uint32_t i = distance; i > 0; --i) { 
+        stack[i] = stack[i - 1]; 
+        stack_position[stack[i]] = i + 1; 
+    }
+    stack[0] = line; 
+    stack_position[line] = 1; 
+}
+
+void profile_access(uint16_t address, int kind) { 
+    reuse_access(address); 
+    if(kind == PROFILE_WRITE) { 
+        ++words[address].writes; 
+    }else if(address == (uint16_t)(registers[R_PC] - 1)) { 
+        // fetchExecute() increments PC before the fetch reaches mem_read()
+        ++words[address].fetches; 
+        return; 
+    }else { 
+        ++words[address].reads; 
+    }
+
+    struct stride_counts* counts = &strides[(uint16_t)(registers[R_PC] - 1)]; 
+    int16_t stride = address - counts->last_address; 
+    if(counts->accesses && stride == counts->stride) ++counts->repeats; 
+    counts->stride = stride; 
+    counts->last_address = address; 
+    ++counts->accesses; 
+}
+
+static FILE* open_output(const char* suffix) { 
+    char path[4096]; 
+    snprintf(path, sizeof(path), "%s%s", output_prefix, suffix); 
+    FILE* file = fopen(path, "w"); 
+    if(!file) perror(path); 
+    return file; 
+}
+
+// log scale a count against the largest one
+static uint8_t shade(uint32_t count, double scale) { 
+    return count ? (uint8_t)(64 + 191 * log1p(count) / scale) : 0; 
+}
+
+static void write_heatmap() { 
+    FILE* file = open_output(".ppm"); 
+    if(!file) return; 
+    uint32_t largest = 1; 
+    for(uint32_t address = 0; address <= UINT16_MAX; ++address) { 
+        if(words[address].reads > largest) largest = words[address].reads; 
+        if(words[address].writes > largest) largest = words[address].writes; 
+        if(words[address].fetches > largest) largest = words[address].fetches; 
+    }
+    double scale = log1p(largest); 
+    fprintf(file, "P6\n256 256\n255\n"); 
+    for(uint32_t address = 0; address <= UINT16_MAX; ++address) { 
+        uint8_t pixel[3] = { 
+            shade(words[address].writes, scale), 
+            shade(words[address].reads, scale), 
+            shade(words[address].fetches, scale), 
+        }; 
+        fwrite(pixel, 1, sizeof(pixel), file); 
+    }
+    fclose(file); 
+}
+
+static void write_counts() { 
+    FILE* file = open_output(".csv"); 
+    if(!file) return; 
+    fprintf(file, "address,reads,writes,fetches\n"); 
+    for(uint32_t address = 0; address <= UINT16_MAX; ++address) { 
+        struct word_counts* counts = &words[address]; 
+        if(!counts->reads && !counts->writes && !counts->fetches) continue; 
+        fprintf(file, "x%04X,%u,%u,%u\n", address, counts->reads, counts->writes, counts->fetches); 
+    }
+    fclose(file); 
+}
+
+static void write_strides() { 
+    FILE* file = open_output(".strides.csv"); 
+    if(!file) return; 
+    fprintf(file, "pc,accesses,stride,repeats\n"); 
+    for(uint32_t pc = 0; pc <= UINT16_MAX; ++pc) { 
+        struct stride_counts* counts = &strides[pc]; 
+        if(!counts->accesses) continue; 
+        fprintf(file, "x%04X,%u,%d,%u\n", pc, counts->accesses, counts->stride, counts->repeats); 
+    }
+    fclose(file); 
+}
+
+static void write_reuse() { 
+    FILE* file = open_output(".reuse.csv"); 
+    if(!file) return; 
+    uint64_t total = 0, hits = 0; 
+    for(int i = 0; i < PROFILE_BUCKETS; ++i) total += reuse[i]; 
+    fprintf(file, "distance_below,accesses,hit_rate\n"); 
+    for(int i = 0; i < PROFILE_BUCKETS - 1; ++i) { 
+        // bucket i holds distances below 1 << i, a cache of 1 << i lines hits them and every bucket before
+        hits += reuse[i]; 
+        fprintf(file, "%u,%llu,%.4f\n", 1u << i, (unsigned long long) reuse[i], total ? (double) hits / total : 0.0); 
+    }
+    fprintf(file, "cold,%llu,\n", (unsigned long long) reuse[PROFILE_BUCKETS - 1]); 
+    fclose(file); 
+}
+
+void profile_close() { 
+    if(!words) return; 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        page_attributes[page] &= ~PAGE_PROFILE; 
+    }
+    write_counts(); 
+    write_heatmap(); 
+    write_strides(); 
+    write_reuse(); 
+    free(words); 
+    free(strides); 
+    words = NULL; 
+    strides = NULL; 
+}
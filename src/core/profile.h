@@ -0,0 +1,40 @@
+#ifndef _PROFILE
+#define _PROFILE
+
+#include<stdint.h> 
+
+/*
+ * Memory access profiler.
+ *
+ * Every page gets the PAGE_PROFILE attribute, accesses are then counted from the
+ * mem_read()/mem_write() slow path ( nothing is added to the fast path, with the
+ * profiler off no page has the attribute ).
+ *
+ * Per word : reads, writes and instruction fetches.
+ * Per issuing PC : data accesses, the last stride and how often it repeated.
+ * Reuse distance : LRU stack distance of the access stream over 64 byte host lines
+ * ( 32 words ), an access with distance d hits in any fully associative LRU cache
+ * holding more than d lines.
+ *
+ * Written at exit :
+ *   PREFIX.csv          address,reads,writes,fetches ( words that were touched )
+ *   PREFIX.ppm          256x256 heatmap, row = page, red = writes, green = reads, blue = fetches
+ *   PREFIX.strides.csv  pc,accesses,stride,repeats
+ *   PREFIX.reuse.csv    distance_below,accesses,hit_rate ( log2 buckets, hit rate of a cache of distance_below lines )
+ */
+enum { 
+    PROFILE_LINE_SHIFT = 5,                         // 32 words = 64 host bytes
+    PROFILE_LINES      = 1 << (16 - PROFILE_LINE_SHIFT), 
+    PROFILE_BUCKETS    = 16 - PROFILE_LINE_SHIFT + 2, // 0, 1, 2-3, ... , cold
+};
+
+enum { 
+    PROFILE_READ = 0, 
+    PROFILE_WRITE, 
+};
+
+int profile_open(const char* prefix); 
+void profile_access(uint16_t address, int kind); 
+void profile_close(); 
+
+#endif
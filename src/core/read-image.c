@@ -14,7 +14,8 @@ void read_image_file(FILE* file, uint16_t memory[]) {
     origin = swap16(origin); 
 
     // We know the maxium file size so we only need one fread
-    uint16_t max_read = UINT16_MAX - origin; 
+    // up to and including the word at xFFFF
+    size_t max_read = (UINT16_MAX + 1) - origin; 
     uint16_t* program = memory + origin; 
     size_t read = fread(program, sizeof(uint16_t), max_read, file); 
 
@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#include <sys/syscall.h>
+
+#include "core.h"
+#include "sampler.h"
+
+// older glibc only has the union member
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+struct sample { 
+    uint16_t pc; 
+    uint16_t r7; 
+    uint32_t weight;   // periods since the previous sample
+}; 
+
+struct symbol { 
+    uint16_t address; 
+    char name[48]; 
+}; 
+
+// ring between the SIGPROF handler ( producer ) and the aggregation thread ( consumer )
+static struct sample ring[SAMPLE_RING_SIZE]; 
+static _Atomic uint32_t head; 
+static _Atomic uint32_t tail; 
+static _Atomic uint64_t dropped; 
+
+// aggregation thread only, then sampler_close()
+static uint64_t pc_samples[UINT16_MAX + 1]; 
+static uint64_t r7_samples[UINT16_MAX + 1]; 
+static uint64_t total; 
+
+static const char** images; 
+static int image_count; 
+static struct symbol* symbols; 
+static int symbol_count; 
+
+static const char* report_path; 
+static int sample_hz; 
+static timer_t timer; 
+static pthread_t aggregator; 
+// sampler_close() wakes the aggregation thread instead of waiting for its next round
+static pthread_mutex_t wake_lock = PTHREAD_MUTEX_INITIALIZER; 
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER; 
+static int stopping; 
+static int opened; 
+
+static void handle_sample(int signal) { 
+    (void) signal; 
+    uint32_t n = atomic_load_explicit(&head, memory_order_relaxed); 
+    if(n - atomic_load_explicit(&tail, memory_order_acquire) == SAMPLE_RING_SIZE) { 
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed); 
+        return; 
+    }
+    // the interpreter may be in the middle of any instruction, read each register once
+    const volatile uint16_t* live = registers; 
+    // cpu clock timers expire on the scheduler tick, periods that went by meanwhile are overruns
+    int overrun = timer_getoverrun(timer); 
+    uint32_t weight = 1 + (overrun > 0 ? overrun : 0); 
+    ring[n & (SAMPLE_RING_SIZE - 1)] = (struct sample) { live[R_PC], live[R_R7], weight }; 
+    atomic_store_explicit(&head, n + 1, memory_order_release); 
+}
+
+// called for every image on the command line, symbols are read by sampler_open()
+void sampler_image(const char* image_path) { 
+    const char** grown = realloc(images, (image_count + 1) * sizeof(*images)); 
+    if(!grown) return; 
+    images = grown; 
+    images[image_count++] = image_path; 
+}
+
+static int by_address(const void* a, const void* b) { 
+    return (int) ((const struct symbol*) a)->address - (int) ((const struct symbol*) b)->address; 
+}
+
+// lc3as writes "//<tab>NAME<spaces>ADDRESS" lines, plain "NAME ADDRESS" lines are taken as well
+static void load_symbols(const char* image_path) { 
+    size_t length = strlen(image_path); 
+    char* path = malloc(length + 5); 
+    if(!path) return; 
+    strcpy(path, image_path); 
+    char* dot = strrchr(path, '.'); 
+    if(!dot || strchr(dot, '/')) dot = path + length; 
+    strcpy(dot, ".sym"); 
+    FILE* file = fopen(path, "r"); 
+    free(path); 
+    if(!file) return; 
+
+    char line[256], name[sizeof(symbols->name)], address[16]; 
+    while(fgets(line, sizeof(line), file)) { 
+        char* start = line; 
+        if(strncmp(start, "//", 2) == 0) start += 2; 
+        if(sscanf(start, " %47s %15s", name, address) != 2) continue; 
+        char* hex = address[0] == 'x' || address[0] == 'X' ? address + 1 : address; 
+        char* end; 
+        unsigned long value = strtoul(hex, &end, 16); 
+        if(*end != '\0' || end == hex || value > UINT16_MAX) continue; 
+        // one per address at most, rank() sorts symbol_count + 1 entries
+        if(symbol_count > UINT16_MAX) break; 
+        struct symbol* grown = realloc(symbols, (symbol_count + 1) * sizeof(*symbols)); 
+        if(!grown) break; 
+        symbols = grown; 
+        symbols[symbol_count].address = value; 
+        strcpy(symbols[symbol_count].name, name); 
+        ++symbol_count; 
+    }
+    fclose(file); 
+}
+
+// index of the nearest symbol at or below address, -1 when there is none
+static int symbol_at(uint16_t address) { 
+    int low = 0, high = symbol_count - 1, found = -1; 
+    while(low <= high) { 
+        int middle = (low + high) / 2; 
+        if(symbols[middle].address <= address) { 
+            found = middle; 
+            low = middle + 1; 
+        }else { 
+            high = middle - 1; 
+        }
+    }
+    return found; 
+}
+
+static void describe(char* out, size_t size, uint16_t address) { 
+    int index = symbol_at(address); 
+    if(index < 0) { 
+        snprintf(out, size, "x%04X", address); 
+    }else if(symbols[index].address == address) { 
+        snprintf(out, size, "x%04X  %s", address, symbols[index].name); 
+    }else { 
+        snprintf(out, size, "x%04X  %s+%u", address, symbols[index].name, (unsigned) (address - symbols[index].address)); 
+    }
+}
+
+static void drain() { 
+    uint32_t from = atomic_load_explicit(&tail, memory_order_relaxed); 
+    uint32_t to = atomic_load_explicit(&head, memory_order_acquire); 
+    for(uint32_t n = from; n != to; ++n) { 
+        struct sample sample = ring[n & (SAMPLE_RING_SIZE - 1)]; 
+        pc_samples[sample.pc] += sample.weight; 
+        r7_samples[sample.r7] += sample.weight; 
+        total += sample.weight; 
+    }
+    atomic_store_explicit(&tail, to, memory_order_release); 
+}
+
+// counts to sort, entries of the top lists
+static const uint64_t* ranked_counts; 
+
+static int by_count(const void* a, const void* b) { 
+    uint64_t x = ranked_counts[*(const int*) a], y = ranked_counts[*(const int*) b]; 
+    if(x != y) return x < y ? 1 : -1; 
+    return *(const int*) a - *(const int*) b; 
+}
+
+// the SAMPLE_TOP largest of counts[0 .. count), then the number of entries written to top
+static int rank(const uint64_t* counts, int count, int* top) { 
+    static int order[UINT16_MAX + 2]; 
+    int used = 0; 
+    for(int i = 0; i < count; ++i) { 
+        if(counts[i]) order[used++] = i; 
+    }
+    ranked_counts = counts; 
+    qsort(order, used, sizeof(order[0]), by_count); 
+    if(used > SAMPLE_TOP) used = SAMPLE_TOP; 
+    memcpy(top, order, used * sizeof(order[0])); 
+    return used; 
+}
+
+static double percent(uint64_t samples) { 
+    return total ? 100.0 * samples / total : 0; 
+}
+
+static void write_report() { 
+    char temporary[4096]; 
+    snprintf(temporary, sizeof(temporary), "%s.tmp", report_path); 
+    FILE* file = fopen(temporary, "w"); 
+    if(!file) return; 
+
+    fprintf(file, "samples %llu dropped %llu hz %d cpu_seconds %.3f\n", (unsigned long long) total,
+            (unsigned long long) atomic_load(&dropped), sample_hz, (double) total / sample_hz); 
+
+    int top[SAMPLE_TOP], count; 
+    char where[80]; 
+    if(symbol_count) { 
+        // one slot per symbol, the last one for addresses below the first symbol
+        uint64_t* by_symbol = calloc(symbol_count + 1, sizeof(uint64_t)); 
+        if(by_symbol) { 
+            for(uint32_t address = 0; address <= UINT16_MAX; ++address) { 
+                if(!pc_samples[address]) continue; 
+                int index = symbol_at(address); 
+                by_symbol[index < 0 ? symbol_count : index] += pc_samples[address]; 
+            }
+            fprintf(file, "\n# self samples by symbol\n"); 
+            count = rank(by_symbol, symbol_count + 1, top); 
+            for(int i = 0; i < count; ++i) { 
+                const char* name = top[i] == symbol_count ? "?" : symbols[top[i]].name; 
+                fprintf(file, "%6.2f%% %10llu  %s\n", percent(by_symbol[top[i]]), (unsigned long long) by_symbol[top[i]], name); 
+            }
+            free(by_symbol); 
+        }
+    }
+
+    fprintf(file, "\n# self samples by pc\n"); 
+    count = rank(pc_samples, UINT16_MAX + 1, top); 
+    for(int i = 0; i < count; ++i) { 
+        describe(where, sizeof(where), top[i]); 
+        fprintf(file, "%6.2f%% %10llu  %s\n", percent(pc_samples[top[i]]), (unsigned long long) pc_samples[top[i]], where); 
+    }
+
+    fprintf(file, "\n# samples by R7 ( return address of the current subroutine )\n"); 
+    count = rank(r7_samples, UINT16_MAX + 1, top); 
+    for(int i = 0; i < count; ++i) { 
+        describe(where, sizeof(where), top[i]); 
+        fprintf(file, "%6.2f%% %10llu  %s\n", percent(r7_samples[top[i]]), (unsigned long long) r7_samples[top[i]], where); 
+    }
+
+    if(fclose(file) == 0) rename(temporary, report_path); 
+    else remove(temporary); 
+}
+
+static void* aggregate(void* unused) { 
+    (void) unused; 
+    int rounds = 0; 
+    pthread_mutex_lock(&wake_lock); 
+    while(!stopping) { 
+        struct timespec until; 
+        clock_gettime(CLOCK_REALTIME, &until); 
+        until.tv_nsec += SAMPLE_DRAIN_MS * 1000000L; 
+        if(until.tv_nsec >= 1000000000L) { 
+            until.tv_nsec -= 1000000000L; 
+            ++until.tv_sec; 
+        }
+        pthread_cond_timedwait(&wake, &wake_lock, &until); 
+        if(stopping) break; 
+        pthread_mutex_unlock(&wake_lock); 
+        drain(); 
+        if(++rounds == SAMPLE_REPORT_MS / SAMPLE_DRAIN_MS) { 
+            write_report(); 
+            rounds = 0; 
+        }
+        pthread_mutex_lock(&wake_lock); 
+    }
+    pthread_mutex_unlock(&wake_lock); 
+    return NULL; 
+}
+
+static void stop_aggregator() { 
+    pthread_mutex_lock(&wake_lock); 
+    stopping = 1; 
+    pthread_cond_signal(&wake); 
+    pthread_mutex_unlock(&wake_lock); 
+    pthread_join(aggregator, NULL); 
+}
+
+int sampler_open(const char* path, int hz) { 
+    if(hz <= 0 || hz > 1000000) return 0; 
+    report_path = path; 
+    sample_hz = hz; 
+    for(int i = 0; i < image_count; ++i) load_symbols(images[i]); 
+    qsort(symbols, symbol_count, sizeof(*symbols), by_address); 
+
+    if(pthread_create(&aggregator, NULL, aggregate, NULL) != 0) return 0; 
+
+    // restarted system calls : a GETC blocked in read() keeps waiting
+    struct sigaction action; 
+    memset(&action, 0, sizeof(action)); 
+    action.sa_handler = handle_sample; 
+    action.sa_flags = SA_RESTART; 
+    sigaction(SIGPROF, &action, NULL); 
+
+    struct sigevent event; 
+    memset(&event, 0, sizeof(event)); 
+    // aimed at the calling ( interpreter ) thread : the handler is the ring's only producer,
+    // whatever other threads ( trace drain, aggregation ... ) are running
+    event.sigev_notify = SIGEV_THREAD_ID; 
+    event.sigev_notify_thread_id = syscall(SYS_gettid); 
+    event.sigev_signo = SIGPROF; 
+    // cpu time of the interpreter thread only, helper threads are not guest code
+    clockid_t clock; 
+    if(pthread_getcpuclockid(pthread_self(), &clock) != 0 || timer_create(clock, &event, &timer) < 0) { 
+        stop_aggregator(); 
+        return 0; 
+    }
+    long period_ns = 1000000000L / hz; 
+    struct itimerspec interval = { 
+        { period_ns / 1000000000L, period_ns % 1000000000L },
+        { period_ns / 1000000000L, period_ns % 1000000000L },
+    }; 
+    timer_settime(timer, 0, &interval, NULL); 
+    opened = 1; 
+    return 1; 
+}
+
+void sampler_close() { 
+    if(!opened) return; 
+    opened = 0; 
+    timer_delete(timer); 
+    signal(SIGPROF, SIG_IGN); 
+    stop_aggregator(); 
+    drain(); 
+    write_report(); 
+}
@@ -0,0 +1,40 @@
+#ifndef _SAMPLER
+#define _SAMPLER
+
+#include<stdint.h>
+
+/*
+ * Sampling profiler ( lc3 --sample=FILE ).
+ *
+ * A timer_create() timer on the CPU clock of the thread that called sampler_open() ( the
+ * interpreter ) raises SIGPROF in that thread ( SIGEV_THREAD_ID ) hz times per second of
+ * its CPU time, time blocked in GETC / IN is not sampled. The handler copies PC and R7 into
+ * a lock free single producer / single consumer ring and returns, a full ring counts the
+ * sample as dropped. The kernel checks cpu clock timers on its scheduler tick, above the
+ * tick rate a sample stands for the periods since the previous one ( timer_getoverrun() ),
+ * so counts are in periods of 1 / hz cpu seconds whatever the tick.
+ *
+ * The register file is the sampled state : every instruction writes PC anyway, so the
+ * dispatch loop pays nothing. A hot trace keeps registers in locals and writes them back
+ * on exit, its samples land on the loop head with R7 as it was on entry. A routine run by --hle lands on its target.
+ *
+ * An aggregation thread drains the ring every SAMPLE_DRAIN_MS into per PC counts and
+ * rewrites FILE every SAMPLE_REPORT_MS and at exit ( through FILE.tmp and rename(), a
+ * reader never sees half a report ) : samples per symbol, per PC and per R7 ( the return
+ * address of the current subroutine ). Symbols come from the .sym file next to each image
+ * ( prog.obj -> prog.sym, lc3as symbol table or "NAME ADDRESS" lines ), an address is
+ * shown as the nearest symbol at or below it plus an offset.
+ */
+enum { 
+    SAMPLE_RING_SIZE  = 1 << 12,  // samples, power of two
+    SAMPLE_DRAIN_MS   = 50,
+    SAMPLE_REPORT_MS  = 10000,
+    SAMPLE_DEFAULT_HZ = 1000,
+    SAMPLE_TOP        = 20,       // lines per section of the report
+}; 
+
+void sampler_image(const char* image_path); 
+int sampler_open(const char* path, int hz); 
+void sampler_close(); 
+
+#endif
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include <sys/mman.h>
+
+#include "core.h"
+#include "opcodes.h"
+#include "trace.h"
+
+// ring between the interpreter ( producer ) and the drain thread ( consumer )
+static struct trace_record ring[TRACE_RING_SIZE]; 
+static _Atomic uint64_t head; 
+static _Atomic uint64_t tail; 
+
+// record of the instruction being executed
+static struct trace_record current; 
+static int fetch_pending; 
+
+static int fd = -1; 
+static struct trace_header* header; 
+static size_t mapped_size; 
+static _Atomic int growing; 
+
+static pthread_t drainer; 
+static _Atomic int stopping; 
+
+static size_t file_size(uint64_t records) { 
+    return sizeof(struct trace_header) + records * sizeof(struct trace_record); 
+}
+
+static struct trace_record* file_records() { 
+    return (struct trace_record*) (header + 1); 
+}
+
+// whole run : make room for the next records ( drain thread only )
+static int grow(uint64_t needed) { 
+    if(file_size(needed) <= mapped_size) return 1; 
+    uint64_t records = (needed + TRACE_GROW - 1) / TRACE_GROW * TRACE_GROW; 
+    size_t size = file_size(records); 
+    if(ftruncate(fd, size) < 0) return 0; 
+
+    atomic_store(&growing, 1); 
+    void* address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); 
+    if(address == MAP_FAILED) { 
+        atomic_store(&growing, 0); 
+        return 0; 
+    }
+    munmap(header, mapped_size); 
+    header = address; 
+    mapped_size = size; 
+    atomic_store(&growing, 0); 
+    return 1; 
+}
+
+// copy ring records [from, to) into the file
+static void copy_out(uint64_t from, uint64_t to) { 
+    struct trace_record* records = file_records(); 
+    for(uint64_t n = from; n < to; ++n) { 
+        uint64_t slot = header->capacity ? n % header->capacity : n; 
+        records[slot] = ring[n & (TRACE_RING_SIZE - 1)]; 
+    }
+    header->count = to; 
+}
+
+static void* drain(void* unused) { 
+    (void) unused; 
+    struct timespec pause = { 0, 100000 }; 
+    while(1) { 
+        uint64_t from = atomic_load_explicit(&tail, memory_order_relaxed); 
+        uint64_t to = atomic_load_explicit(&head, memory_order_acquire); 
+        if(from == to) { 
+            if(atomic_load(&stopping)) break; 
+            nanosleep(&pause, NULL); 
+            continue; 
+        }
+        if(!header->capacity && !grow(to)) { 
+            // out of disk : the rest of the run is dropped
+            atomic_store_explicit(&tail, to, memory_order_release); 
+            continue; 
+        }
+        copy_out(from, to); 
+        atomic_store_explicit(&tail, to, memory_order_release); 
+    }
+    return NULL; 
+}
+
+// last words on a crash : save what is still in the ring
+static void handle_crash(int signal) { 
+    if(header && !atomic_load(&growing)) { 
+        uint64_t from = atomic_load(&tail); 
+        uint64_t to = atomic_load(&head); 
+        if(header->capacity || file_size(to) <= mapped_size) copy_out(from, to); 
+    }
+    raise(signal); 
+}
+
+/*
+ * Start tracing into path.
+ * keep_last = 0 keeps the whole run, otherwise only the last keep_last instructions.
+ */
+int trace_open(const char* path, uint64_t keep_last) { 
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644); 
+    if(fd < 0) return 0; 
+    mapped_size = file_size(keep_last ? keep_last : TRACE_GROW); 
+    if(ftruncate(fd, mapped_size) < 0) return 0; 
+    header = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); 
+    if(header == MAP_FAILED) return 0; 
+
+    header->magic = TRACE_MAGIC; 
+    header->version = TRACE_VERSION; 
+    header->record_size = sizeof(struct trace_record); 
+    header->capacity = keep_last; 
+    header->count = 0; 
+
+    if(pthread_create(&drainer, NULL, drain, NULL) != 0) return 0; 
+
+    struct sigaction action; 
+    memset(&action, 0, sizeof(action)); 
+    action.sa_handler = handle_crash; 
+    action.sa_flags = SA_RESETHAND; 
+    sigaction(SIGABRT, &action, NULL); 
+    sigaction(SIGSEGV, &action, NULL); 
+
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        page_attributes[page] |= PAGE_TRACE; 
+    }
+    return 1; 
+}
+
+// called before fetchExecute()
+void trace_begin() { 
+    current.pc = registers[R_PC]; 
+    current.dest = 0; 
+    current.address = 0; 
+    current.value = 0; 
+    current.flags = 0; 
+    fetch_pending = 1; 
+}
+
+// called from the mem_read()/mem_write() slow path, the first read of an instruction is its fetch
+void trace_memory(uint16_t address, uint16_t value, uint16_t kind) { 
+    if(fetch_pending) { 
+        current.instruction = value; 
+        fetch_pending = 0; 
+        return; 
+    }
+    current.address = address; 
+    current.value = value; 
+    current.flags = (current.flags & ~(TRACE_LOAD | TRACE_STORE)) | kind; 
+}
+
+// called after fetchExecute()
+void trace_end() { 
+    uint16_t instruction = current.instruction; 
+    switch(instruction >> 12) { 
+    case OP_ADD: 
+    case OP_AND: 
+    case OP_NOT: 
+    case OP_LD: 
+    case OP_LDI: 
+    case OP_LDR: 
+    case OP_LEA: 
+        current.dest = registers[(instruction >> 9) & 0x7]; 
+        current.flags |= TRACE_DEST; 
+        break; 
+    case OP_JSR: 
+        current.dest = registers[R_R7]; 
+        current.flags |= TRACE_DEST; 
+        break; 
+    case OP_TRAP: 
+        if((instruction & 0xFF) == TRAP_GETC || (instruction & 0xFF) == TRAP_IN) { 
+            current.dest = registers[R_R0]; 
+            current.flags |= TRACE_DEST; 
+        }
+        break; 
+    }
+
+    uint64_t n = atomic_load_explicit(&head, memory_order_relaxed); 
+    // ring full : wait for the drain thread
+    while(n - atomic_load_explicit(&tail, memory_order_acquire) == TRACE_RING_SIZE) { 
+        sched_yield(); 
+    }
+    ring[n & (TRACE_RING_SIZE - 1)] = current; 
+    atomic_store_explicit(&head, n + 1, memory_order_release); 
+}
+
+void trace_close() { 
+    if(!header) return; 
+    atomic_store(&stopping, 1); 
+    pthread_join(drainer, NULL); 
+
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        page_attributes[page] &= ~PAGE_TRACE; 
+    }
+    uint64_t records = header->capacity ? header->capacity : header->count; 
+    munmap(header, mapped_size); 
+    header = NULL; 
+    if(ftruncate(fd, file_size(records)) < 0) perror("trace"); 
+    close(fd); 
+}
@@ -0,0 +1,56 @@
+#ifndef _TRACE
+#define _TRACE
+
+#include<stdint.h> 
+
+/*
+ * Binary execution trace.
+ *
+ * One fixed size record per executed instruction. Records go into a lock free
+ * single producer / single consumer ring, a drain thread copies them into a
+ * mmap'd file. Memory accesses are seen through the PAGE_TRACE page attribute,
+ * so nothing is added to mem_read()/mem_write() when tracing is off.
+ *
+ * File layout ( host byte order ) :
+ *   struct trace_header
+ *   capacity records ( keep last mode, record n is at slot n % capacity )
+ *   or count records ( whole run )
+ */
+enum { 
+    TRACE_MAGIC     = 0x5433434C, // "LC3T"
+    TRACE_VERSION   = 1, 
+    TRACE_RING_SIZE = 1 << 16,    // records, power of two
+    TRACE_GROW      = 1 << 20,    // records added each time a whole run file grows
+};
+
+// record flags
+enum { 
+    TRACE_DEST  = 1 << 0, // dest holds the value written to the destination register
+    TRACE_LOAD  = 1 << 1, // address / value of the last load
+    TRACE_STORE = 1 << 2, // address / value of the store
+};
+
+struct trace_record { 
+    uint16_t pc; 
+    uint16_t instruction; 
+    uint16_t dest; 
+    uint16_t address; 
+    uint16_t value; 
+    uint16_t flags; 
+};
+
+struct trace_header { 
+    uint32_t magic; 
+    uint16_t version; 
+    uint16_t record_size; 
+    uint64_t capacity;  // records the file holds, 0 = whole run
+    uint64_t count;     // records written
+};
+
+int trace_open(const char* path, uint64_t keep_last); 
+void trace_begin(); 
+void trace_end(); 
+void trace_memory(uint16_t address, uint16_t value, uint16_t kind); 
+void trace_close(); 
+
+#endif
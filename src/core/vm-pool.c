@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "core.h"
+#include "vm-pool.h"
+#include "compress.h"
+#include "checkpoint.h"
+
+enum { 
+    HUGE_PAGE_SIZE = 2 << 20,
+    SLOT_ALIGNMENT = 4096,
+}; 
+
+// the context memory points into, NULL while the interpreter runs on machine_memory
+static struct vm_context* loaded; 
+
+static size_t round_up(size_t size, size_t alignment) { 
+    return (size + alignment - 1) / alignment * alignment; 
+}
+
+// highest node in /sys/devices/system/node/online ( "0", "0-3", "0,2-3" ... ) plus one
+static int node_count() { 
+    FILE* file = fopen("/sys/devices/system/node/online", "r"); 
+    if(!file) return 1; 
+    int highest = 0, value; 
+    char separator; 
+    while(fscanf(file, "%d%c", &value, &separator) >= 1) { 
+        if(value > highest) highest = value; 
+        if(separator == '\n') break; 
+    }
+    fclose(file); 
+    return highest + 1 > VM_MAX_NODES ? VM_MAX_NODES : highest + 1; 
+}
+
+static int current_node() { 
+    unsigned cpu, node; 
+    if(syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return 0; 
+    return (int) node; 
+}
+
+// preferred, not strict : a full node still hands out memory from the others
+static void bind_to_node(void* address, size_t size, int node) { 
+    unsigned long mask[VM_MAX_NODES / (8 * sizeof(unsigned long))] = { 0 }; 
+    mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long))); 
+    syscall(SYS_mbind, address, size, MPOL_PREFERRED, mask, VM_MAX_NODES + 1, 0); 
+}
+
+/*
+ * Huge pages are only taken when the kernel has them reserved : without MAP_NORESERVE
+ * the mapping fails up front instead of faulting later. Otherwise ask for transparent ones.
+ */
+static int map_arena(struct vm_arena* arena, size_t size, int node) { 
+    size = round_up(size, HUGE_PAGE_SIZE); 
+    arena->huge = 1; 
+    arena->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0); 
+    if(arena->base == MAP_FAILED) { 
+        arena->huge = 0; 
+        arena->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0); 
+        if(arena->base == MAP_FAILED) { 
+            arena->base = NULL; 
+            return 0; 
+        }
+        madvise(arena->base, size, MADV_HUGEPAGE); 
+    }
+    arena->mapped = size; 
+    bind_to_node(arena->base, size, node); 
+    return 1; 
+}
+
+int vm_pool_create(struct vm_pool* pool, size_t capacity) { 
+    memset(pool, 0, sizeof(*pool)); 
+    pool->nodes = node_count(); 
+    pool->slot_size = round_up(sizeof(struct vm_context), SLOT_ALIGNMENT); 
+    if(!capacity) capacity = VM_DEFAULT_CAPACITY; 
+    for(int node = 0; node < pool->nodes; ++node) { 
+        struct vm_arena* arena = &pool->arenas[node]; 
+        pthread_mutex_init(&arena->lock, NULL); 
+        arena->capacity = capacity; 
+        if(!map_arena(arena, capacity * pool->slot_size, node)) { 
+            vm_pool_destroy(pool); 
+            return 0; 
+        }
+    }
+    return 1; 
+}
+
+void vm_pool_destroy(struct vm_pool* pool) { 
+    for(int node = 0; node < pool->nodes; ++node) { 
+        struct vm_arena* arena = &pool->arenas[node]; 
+        if(arena->base) munmap(arena->base, arena->mapped); 
+        pthread_mutex_destroy(&arena->lock); 
+    }
+    memset(pool, 0, sizeof(*pool)); 
+}
+
+int vm_worker_pin(int cpu) { 
+    cpu_set_t set; 
+    CPU_ZERO(&set); 
+    CPU_SET(cpu, &set); 
+    if(pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) return -1; 
+    return current_node(); 
+}
+
+static struct vm_context* take(struct vm_pool* pool, int node) { 
+    struct vm_arena* arena = &pool->arenas[node]; 
+    struct vm_context* vm = NULL; 
+    pthread_mutex_lock(&arena->lock); 
+    if(arena->free) { 
+        vm = arena->free; 
+        arena->free = vm->next_free; 
+    }else if(arena->used < arena->capacity) { 
+        vm = (struct vm_context*) (arena->base + arena->used++ * pool->slot_size); 
+    }
+    pthread_mutex_unlock(&arena->lock); 
+    if(vm) { 
+        vm->node = node; 
+        vm->next_free = NULL; 
+    }
+    return vm; 
+}
+
+// from the caller's node, another node only when that one is full
+struct vm_context* vm_alloc(struct vm_pool* pool) { 
+    int home = current_node(); 
+    if(home >= pool->nodes) home = 0; 
+    struct vm_context* vm = take(pool, home); 
+    for(int node = 0; !vm && node < pool->nodes; ++node) { 
+        if(node != home) vm = take(pool, node); 
+    }
+    return vm; 
+}
+
+void vm_free(struct vm_pool* pool, struct vm_context* vm) { 
+    // written since the load without a save, still to be cleared
+    if(vm == loaded) vm_context_unload(); 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        if(!vm->dirty[page]) continue; 
+        memset(vm->memory + ((size_t) page << PAGE_SHIFT), 0, PAGE_SIZE * sizeof(uint16_t)); 
+        vm->dirty[page] = 0; 
+    }
+    memset(vm->registers, 0, sizeof(vm->registers)); 
+    vm->input_size = 0; 
+    vm->input_position = 0; 
+    vm->output_size = 0; 
+
+    struct vm_arena* arena = &pool->arenas[vm->node]; 
+    pthread_mutex_lock(&arena->lock); 
+    vm->next_free = arena->free; 
+    arena->free = vm; 
+    pthread_mutex_unlock(&arena->lock); 
+}
+
+void vm_context_load_image(struct vm_context* vm, const struct cached_image* image) { 
+    memcpy(vm->memory + image->origin, image->words, image->length * sizeof(uint16_t)); 
+    for(uint32_t address = image->origin; address < (uint32_t) image->origin + image->length; address += PAGE_SIZE) { 
+        vm->dirty[address >> PAGE_SHIFT] = 1; 
+    }
+    if(image->length) vm->dirty[(image->origin + image->length - 1) >> PAGE_SHIFT] = 1; 
+}
+
+/*
+ * Lazy and compressed pages hold their words outside memory[], they belong to the memory
+ * being left and are faulted in before the switch. Every page then counts as written for
+ * the other users of dirty_pages ( fuzz snapshot, checkpoints, HLE lookups ), the words
+ * behind each address changed.
+ */
+static void switch_memory(uint16_t* to) { 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        if(page_attributes[page] & PAGE_LAZY) checkpoint_fault(page); 
+        if(page_attributes[page] & PAGE_COMPRESSED) compress_fault(page); 
+        dirty_pages[page] = DIRTY_ALL & ~DIRTY_POOL; 
+    }
+    memory = to; 
+}
+
+void vm_context_load(struct vm_context* vm) { 
+    if(loaded) vm_context_unload(); 
+    switch_memory(vm->memory); 
+    loaded = vm; 
+    memcpy(registers, vm->registers, sizeof(registers)); 
+}
+
+// DIRTY_POOL pages go into the context's dirty map, vm_free() clears them
+void vm_context_save(struct vm_context* vm) { 
+    if(vm != loaded) return; 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        if(!(dirty_pages[page] & DIRTY_POOL)) continue; 
+        vm->dirty[page] = 1; 
+        dirty_pages[page] &= ~DIRTY_POOL; 
+    }
+    memcpy(vm->registers, registers, sizeof(vm->registers)); 
+}
+
+void vm_context_unload() { 
+    if(!loaded) return; 
+    vm_context_save(loaded); 
+    loaded = NULL; 
+    switch_memory(machine_memory); 
+}
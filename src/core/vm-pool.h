@@ -0,0 +1,87 @@
+#ifndef _VM_POOL
+#define _VM_POOL
+
+#include<stdint.h>
+#include<stddef.h>
+#include<pthread.h>
+
+#include "core.h"
+#include "image-cache.h"
+
+/*
+ * VM context pool.
+ *
+ * Guest memory, registers and console buffers of many VMs, carved out of one arena per
+ * NUMA node. An arena is a single mapping ( 2 MiB huge pages when the kernel has them
+ * reserved, transparent huge pages otherwise ) bound to its node with mbind(), so a
+ * context is always allocated from the node of the thread asking for it. Workers pin
+ * themselves to a cpu with vm_worker_pin() first so that node does not change.
+ *
+ * Fresh slots come zeroed from the kernel. A freed slot goes on its node's free list and
+ * only the pages its dirty map shows written are cleared, a guest that touched four pages
+ * costs four page clears to recycle, not 128 KiB.
+ *
+ * vm_context_load() points memory at the context's own words, the guest runs on its node
+ * without a copy. registers[] is copied in, vm_context_save() copies it back and records
+ * the pages written since the load ( DIRTY_POOL ) in the context's dirty map.
+ * vm_context_unload() saves and goes back to machine_memory, loading another context or
+ * freeing the loaded one does it as well.
+ *
+ * Scope : the interpreter state ( registers[], dirty_pages[], page_attributes[], memory )
+ * is per process, so one thread runs guests at a time. Scale out with one worker process
+ * per cpu, each pinned and taking its contexts from its own node. Hot traces, breakpoints
+ * and checkpoint chains belong to the process too, a host switching contexts runs without
+ * them. lc3 runs a single VM and does not use the pool, src/bench/vm-pool-bench.c is the
+ * host that does.
+ */
+enum { 
+    VM_IO_SIZE          = 1024,      // console input / output buffered per VM
+    VM_MAX_NODES        = 64,
+    VM_DEFAULT_CAPACITY = 1 << 14,   // slots reserved per node
+}; 
+
+struct vm_context { 
+    uint16_t memory[UINT16_MAX + 1]; 
+    uint16_t registers[R_COUNT]; 
+    uint8_t dirty[PAGE_COUNT];       // non zero : page may hold something other than zeros
+    uint16_t node; 
+    uint32_t input_size; 
+    uint32_t input_position; 
+    uint32_t output_size; 
+    char input[VM_IO_SIZE]; 
+    char output[VM_IO_SIZE]; 
+    struct vm_context* next_free; 
+}; 
+
+struct vm_arena { 
+    pthread_mutex_t lock; 
+    char* base; 
+    size_t mapped; 
+    size_t capacity;                 // slots
+    size_t used;                     // slots handed out at least once
+    struct vm_context* free; 
+    int huge;                        // 1 : MAP_HUGETLB, 0 : transparent huge pages at best
+}; 
+
+struct vm_pool { 
+    int nodes; 
+    size_t slot_size; 
+    struct vm_arena arenas[VM_MAX_NODES]; 
+}; 
+
+// capacity = slots per node, 0 = VM_DEFAULT_CAPACITY
+int vm_pool_create(struct vm_pool* pool, size_t capacity); 
+void vm_pool_destroy(struct vm_pool* pool); 
+
+// pin the calling thread to cpu, returns its NUMA node or -1
+int vm_worker_pin(int cpu); 
+
+struct vm_context* vm_alloc(struct vm_pool* pool); 
+void vm_free(struct vm_pool* pool, struct vm_context* vm); 
+
+void vm_context_load_image(struct vm_context* vm, const struct cached_image* image); 
+void vm_context_load(struct vm_context* vm); 
+void vm_context_save(struct vm_context* vm); 
+void vm_context_unload(); 
+
+#endif
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "./core/core.h"
+#include "./core/debug.h"
+#include "instruction-set.h"
+#include "execute.h"
+
+// Standard fetch/execute cycle using switch statement
+void fetchExecute() {
+  /* FETCH */
+  uint16_t instruction = mem_read(registers[R_PC]++);
+  ++instructions_retired;
+  uint16_t opcode = instruction >> 12;
+
+  switch (opcode) {
+  case OP_ADD:
+    add(instruction);      
+    break;
+  case OP_AND:
+    and(instruction);
+    break;
+  case OP_NOT:
+    not(instruction);
+    break;
+  case OP_BR:
+    branch(instruction);
+    break;
+  case OP_JMP:
+    jump(instruction);
+    break;
+  case OP_JSR:
+    jumpToSubroutine(instruction);
+    break;
+  case OP_LD:
+    load(instruction);
+    break;
+  case OP_LDI:
+    loadIndirect(instruction);
+    break;
+  case OP_LDR:
+    loadRegister(instruction);
+    break;
+  case OP_LEA:
+    loadEffectiveAddress(instruction);
+    break;
+  case OP_ST:
+    store(instruction);
+    break;
+  case OP_STI:
+    storeIndirect(instruction);
+    break;
+  case OP_STR:
+    storeRegister(instruction);
+    break;
+  case OP_TRAP:
+    trap(instruction);
+    break;
+  case OP_RES:
+    if (block_ops_enabled)
+      blockOperation(instruction);
+    else
+      abort();
+    break;
+  case OP_RTI:
+    // no supervisor mode : RTI only shows up as a debugger breakpoint
+    if (!debug_breakpoint_hit())
+      abort();
+    break;
+  default:
+    // Bad opcode
+    printf("BAD OPCODE\n");
+    break;
+  }
+}
@@ -0,0 +1,6 @@
+#ifndef _EXECUTE
+#define _EXECUTE
+
+void fetchExecute(); 
+
+#endif
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/shm.h>
+
+#include "./core/core.h"
+#include "./core/keyboard.h"
+#include "./core/checkpoint.h"
+#include "./core/compress.h"
+#include "execute.h"
+#include "fuzz.h"
+
+// machine state at the marked PC
+static uint16_t snapshot_memory[PAGE_COUNT * PAGE_SIZE]; 
+static uint16_t snapshot_registers[R_COUNT]; 
+
+static uint8_t input[FUZZ_MAX_INPUT]; 
+
+// spread guest addresses over the bitmap
+static uint16_t scramble(uint16_t address) { 
+    return (uint16_t)(address * 40503u); 
+}
+
+// record a control flow edge ( called from branch() and jump() )
+void fuzz_edge(uint16_t from, uint16_t to) { 
+    coverage_map[(scramble(from) >> 1) ^ scramble(to)]++; 
+}
+
+void fuzz_snapshot() { 
+    // lazy ( --restore ) and compressed pages hold nothing yet, fault them in first
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        if(page_attributes[page] & PAGE_LAZY) checkpoint_fault(page); 
+        if(page_attributes[page] & PAGE_COMPRESSED) compress_fault(page); 
+    }
+    memcpy(snapshot_memory, memory, sizeof(snapshot_memory)); 
+    memcpy(snapshot_registers, registers, sizeof(registers)); 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        dirty_pages[page] &= ~DIRTY_SNAPSHOT; 
+    }
+}
+
+/*
+ * Copy back only the pages written since the snapshot. The words of a restored page
+ * changed again for every other user of dirty_pages ( HLE targets found on it, checkpoints ).
+ */
+void fuzz_restore() { 
+    for(int page = 0; page < PAGE_COUNT; ++page) { 
+        if(dirty_pages[page] & DIRTY_SNAPSHOT) { 
+            uint32_t start = page << PAGE_SHIFT; 
+            memcpy(memory + start, snapshot_memory + start, PAGE_SIZE * sizeof(uint16_t)); 
+            dirty_pages[page] = DIRTY_ALL & ~DIRTY_SNAPSHOT; 
+        }
+    }
+    memcpy(registers, snapshot_registers, sizeof(registers)); 
+    running = 1; 
+}
+
+// run one input from the snapshot
+static void fuzz_one(size_t size) { 
+    fuzz_restore(); 
+    keyboard_set_buffer(input, size); 
+    for(uint32_t n = 0; running && n < FUZZ_BUDGET; ++n) { 
+        fetchExecute(); 
+    }
+}
+
+// read the current input, afl-fuzz rewrites the file behind stdin for every run
+static size_t read_input() { 
+    lseek(STDIN_FILENO, 0, SEEK_SET); 
+    size_t size = 0; 
+    while(size < sizeof(input)) { 
+        ssize_t got = read(STDIN_FILENO, input + size, sizeof(input) - size); 
+        if(got <= 0) break; 
+        size += got; 
+    }
+    return size; 
+}
+
+// persistent child : run inputs back to back, stopping itself between them
+static void fuzz_child() { 
+    for(int i = 0; i < FUZZ_ITERATIONS; ++i) { 
+        if(i) raise(SIGSTOP); 
+        fuzz_one(read_input()); 
+    }
+    exit(0); 
+}
+
+// AFL fork server loop, only returns if afl-fuzz is not on the other end
+static void fork_server() { 
+    uint32_t message = 0; 
+    if(write(FUZZ_FORKSRV_FD + 1, &message, 4) != 4) return; 
+
+    pid_t child = -1; 
+    int child_stopped = 0; 
+    while(1) { 
+        uint32_t was_killed; 
+        if(read(FUZZ_FORKSRV_FD, &was_killed, 4) != 4) exit(1); 
+
+        // afl-fuzz killed a stopped child after a timeout
+        if(child_stopped && was_killed) { 
+            child_stopped = 0; 
+            waitpid(child, NULL, 0); 
+        }
+
+        if(!child_stopped) { 
+            child = fork(); 
+            if(child < 0) exit(1); 
+            if(!child) { 
+                close(FUZZ_FORKSRV_FD); 
+                close(FUZZ_FORKSRV_FD + 1); 
+                fuzz_child(); 
+            }
+        }else { 
+            kill(child, SIGCONT); 
+            child_stopped = 0; 
+        }
+
+        int status; 
+        if(write(FUZZ_FORKSRV_FD + 1, &child, 4) != 4) exit(1); 
+        if(waitpid(child, &status, WUNTRACED) < 0) exit(1); 
+        if(WIFSTOPPED(status)) child_stopped = 1; 
+        if(write(FUZZ_FORKSRV_FD + 1, &status, 4) != 4) exit(1); 
+    }
+}
+
+void fuzz_main(uint16_t mark) { 
+    // no terminal : input only comes from the fuzzer
+    keyboard_source = KB_BUFFER; 
+    keyboard_set_buffer(input, 0); 
+
+    // startup code runs once
+    running = 1; 
+    while(running && registers[R_PC] != mark) { 
+        fetchExecute(); 
+    }
+    if(!running) { 
+        printf("program halted before reaching 0x%04x\n", mark); 
+        exit(1); 
+    }
+    fuzz_snapshot(); 
+
+    char* shm_id = getenv("__AFL_SHM_ID"); 
+    if(shm_id) { 
+        coverage_map = shmat(atoi(shm_id), NULL, 0); 
+        if(coverage_map == (void*) -1) exit(1); 
+    }else { 
+        coverage_map = calloc(FUZZ_MAP_SIZE, 1); 
+    }
+
+    fork_server(); 
+
+    // stand alone : run the single input on stdin
+    fuzz_one(read_input()); 
+    exit(0); 
+}
@@ -0,0 +1,28 @@
+#ifndef _FUZZ
+#define _FUZZ
+
+#include<stdint.h> 
+
+/*
+ * Persistent fuzzing mode.
+ * The image runs once up to a marked PC, the machine state is snapshotted, and every
+ * input after that restarts from the snapshot instead of from a fresh process.
+ * Talks the AFL fork server protocol when started by afl-fuzz.
+ */
+enum { 
+    FUZZ_MAP_SIZE   = 1 << 16,  // coverage bitmap size ( same as AFL )
+    FUZZ_FORKSRV_FD = 198,      // AFL control pipe, status pipe is FUZZ_FORKSRV_FD + 1
+    FUZZ_ITERATIONS = 10000,    // inputs run by one child before it is replaced
+    FUZZ_BUDGET     = 1 << 20,  // instructions allowed per input
+    FUZZ_MAX_INPUT  = 1 << 16,  // bytes of input fed to the keyboard
+};
+
+// branch edge hit counts, NULL when not fuzzing
+uint8_t* coverage_map; 
+
+void fuzz_edge(uint16_t from, uint16_t to); 
+void fuzz_snapshot(); 
+void fuzz_restore(); 
+void fuzz_main(uint16_t mark); 
+
+#endif
@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "./core/core.h"
+#include "./core/debug.h"
+#include "execute.h"
+#include "gdb-stub.h"
+
+enum { 
+    GDB_PACKET_SIZE = 4096, 
+    GDB_SIGINT      = 2, 
+    GDB_SIGTRAP     = 5, 
+}; 
+
+static int server = -1; 
+static int client = -1; 
+static volatile int guest_running; // only then does input from gdb interrupt the guest
+static volatile int connect_pending; // SIGIO without a client : gdb is connecting
+static char packet[GDB_PACKET_SIZE]; 
+
+static const char hex_digits[] = "0123456789abcdef"; 
+
+static int hex_value(char c) { 
+    if(c >= '0' && c <= '9') return c - '0'; 
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10; 
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10; 
+    return -1; 
+}
+
+// parse hex digits, stops at the first non hex character
+static uint32_t parse_hex(const char** text) { 
+    uint32_t value = 0; 
+    int digit; 
+    while((digit = hex_value(**text)) >= 0) { 
+        value = value << 4 | digit; 
+        ++*text; 
+    }
+    return value; 
+}
+
+// 16 bit value as 4 hex digits, low byte first
+static char* put_word(char* out, uint16_t value) { 
+    *out++ = hex_digits[(value >> 4) & 0xF]; 
+    *out++ = hex_digits[value & 0xF]; 
+    *out++ = hex_digits[(value >> 12) & 0xF]; 
+    *out++ = hex_digits[(value >> 8) & 0xF]; 
+    return out; 
+}
+
+static uint16_t get_word(const char* in) { 
+    return (uint16_t) (hex_value(in[0]) << 4 | hex_value(in[1]) | hex_value(in[2]) << 12 | hex_value(in[3]) << 8); 
+}
+
+static int read_char() { 
+    unsigned char c; 
+    if(read(client, &c, 1) != 1) return -1; 
+    return c; 
+}
+
+// wait for the next packet, the contents end up in packet
+static int get_packet() { 
+    while(1) { 
+        int c; 
+        while((c = read_char()) != '$') { 
+            if(c < 0) return 0; 
+        }
+        size_t length = 0; 
+        uint8_t sum = 0; 
+        while((c = read_char()) != '#') { 
+            if(c < 0) return 0; 
+            if(length < sizeof(packet) - 1) packet[length++] = c; 
+            sum += c; 
+        }
+        packet[length] = 0; 
+        int high = hex_value(read_char()); 
+        int low = hex_value(read_char()); 
+        if(high >= 0 && low >= 0 && (high << 4 | low) == sum) { 
+            if(write(client, "+", 1) != 1) return 0; 
+            return 1; 
+        }
+        if(write(client, "-", 1) != 1) return 0; 
+    }
+}
+
+static void put_packet(const char* data) { 
+    static char out[GDB_PACKET_SIZE + 4]; 
+    uint8_t sum = 0; 
+    size_t length = 0; 
+    out[length++] = '$'; 
+    for(const char* c = data; *c && length < GDB_PACKET_SIZE; ++c) { 
+        out[length++] = *c; 
+        sum += *c; 
+    }
+    out[length++] = '#'; 
+    out[length++] = hex_digits[sum >> 4]; 
+    out[length++] = hex_digits[sum & 0xF]; 
+    do { 
+        if(write(client, out, length) != (ssize_t) length) return; 
+    }while(read_char() == '-'); 
+}
+
+static void report_stop() { 
+    char reply[64]; 
+    if(debug_stop == DEBUG_STOP_WATCHPOINT) { 
+        const char* kind = debug_watch_kind == WATCH_WRITE ? "watch" : debug_watch_kind == WATCH_READ ? "rwatch" : "awatch"; 
+        snprintf(reply, sizeof(reply), "T%02x%s:%x;", GDB_SIGTRAP, kind, debug_watch_address * 2); 
+    }else { 
+        snprintf(reply, sizeof(reply), "S%02x", debug_stop == DEBUG_STOP_INTERRUPT ? GDB_SIGINT : GDB_SIGTRAP); 
+    }
+    put_packet(reply); 
+}
+
+// execute one instruction, running the original word if PC sits on a breakpoint
+static void step() { 
+    uint16_t pc = registers[R_PC]; 
+    int breakpoint = debug_is_breakpoint(pc); 
+    if(breakpoint) debug_remove_breakpoint(pc); 
+    debug_stop = DEBUG_STOP_NONE; 
+    running = 1; 
+    debug_begin(); 
+    fetchExecute(); 
+    if(breakpoint) debug_insert_breakpoint(pc); 
+}
+
+static void read_memory(const char* args) { 
+    char* out = packet; 
+    uint32_t address = parse_hex(&args); 
+    ++args; 
+    uint32_t length = parse_hex(&args); 
+    if(length > (GDB_PACKET_SIZE - 1) / 2) length = (GDB_PACKET_SIZE - 1) / 2; 
+    for(uint32_t byte = address; byte < address + length; ++byte) { 
+        uint16_t word = debug_peek((uint16_t) (byte >> 1)); 
+        uint8_t value = byte & 1 ? word >> 8 : word & 0xFF; 
+        *out++ = hex_digits[value >> 4]; 
+        *out++ = hex_digits[value & 0xF]; 
+    }
+    *out = 0; 
+    put_packet(packet); 
+}
+
+static void write_memory(const char* args) { 
+    uint32_t address = parse_hex(&args); 
+    ++args; 
+    uint32_t length = parse_hex(&args); 
+    ++args; 
+    for(uint32_t byte = address; byte < address + length; ++byte, args += 2) { 
+        int high = hex_value(args[0]), low = hex_value(args[1]); 
+        if(high < 0 || low < 0) { 
+            put_packet("E01"); 
+            return; 
+        }
+        uint16_t word_address = (uint16_t) (byte >> 1); 
+        uint16_t word = debug_peek(word_address); 
+        uint8_t value = high << 4 | low; 
+        word = byte & 1 ? (word & 0x00FF) | value << 8 : (word & 0xFF00) | value; 
+        debug_poke(word_address, word); 
+    }
+    put_packet("OK"); 
+}
+
+// Z / z packets : type,address,kind
+static void breakpoint_packet(const char* args, int insert) { 
+    int type = hex_value(*args); 
+    args += 2; 
+    uint32_t address = parse_hex(&args) >> 1; 
+    ++args; 
+    uint32_t length = (parse_hex(&args) + 1) >> 1; 
+    int ok; 
+    switch(type) { 
+    case 0: // software and hardware breakpoints are the same thing here
+    case 1: 
+        ok = insert ? debug_insert_breakpoint(address) : debug_remove_breakpoint(address); 
+        break; 
+    case 2: 
+    case 3: 
+    case 4: { 
+        int kind = type == 2 ? WATCH_WRITE : type == 3 ? WATCH_READ : WATCH_ACCESS; 
+        if(!length) length = 1; 
+        ok = insert ? debug_insert_watchpoint(address, length, kind) : debug_remove_watchpoint(address, length, kind); 
+        break; 
+    }
+    default: 
+        put_packet(""); 
+        return; 
+    }
+    put_packet(ok ? "OK" : "E01"); 
+}
+
+static void detach() { 
+    debug_remove_all(); 
+    debug_stop = DEBUG_STOP_NONE; 
+    guest_running = 0; 
+    close(client); 
+    client = -1; 
+    // a connection that queued up meanwhile raised no SIGIO of its own
+    connect_pending = 1; 
+}
+
+/*
+ * Answer packets until gdb resumes the guest.
+ * Returns with running set when the fetch/execute loop should go on.
+ */
+static void serve() { 
+    while(client >= 0) { 
+        if(!get_packet()) { 
+            detach(); 
+            break; 
+        }
+        const char* args = packet + 1; 
+        switch(packet[0]) { 
+        case '?': 
+            report_stop(); 
+            break; 
+        case 'g': { 
+            char* out = packet; 
+            for(int r = 0; r < R_COUNT; ++r) out = put_word(out, registers[r]); 
+            *out = 0; 
+            put_packet(packet); 
+            break; 
+        }
+        case 'G': 
+            for(int r = 0; r < R_COUNT && strlen(args) >= 4; ++r, args += 4) registers[r] = get_word(args); 
+            put_packet("OK"); 
+            break; 
+        case 'p': { 
+            uint32_t r = parse_hex(&args); 
+            char reply[8]; 
+            if(r >= R_COUNT) { 
+                put_packet("E01"); 
+                break; 
+            }
+            *put_word(reply, registers[r]) = 0; 
+            put_packet(reply); 
+            break; 
+        }
+        case 'P': { 
+            uint32_t r = parse_hex(&args); 
+            if(r >= R_COUNT || *args != '=' || strlen(args + 1) < 4) { 
+                put_packet("E01"); 
+                break; 
+            }
+            registers[r] = get_word(args + 1); 
+            put_packet("OK"); 
+            break; 
+        }
+        case 'm': 
+            read_memory(args); 
+            break; 
+        case 'M': 
+            write_memory(args); 
+            break; 
+        case 'Z': 
+        case 'z': 
+            breakpoint_packet(args, packet[0] == 'Z'); 
+            break; 
+        case 's': 
+        case 'c': 
+            if(*args) registers[R_PC] = (uint16_t) (parse_hex(&args) >> 1); 
+            // leave a breakpoint at PC behind first
+            step(); 
+            if(halted) return; 
+            if(packet[0] == 's' || debug_stop != DEBUG_STOP_NONE) { 
+                if(debug_stop == DEBUG_STOP_NONE) debug_stop = DEBUG_STOP_BREAKPOINT; 
+                report_stop(); 
+                break; 
+            }
+            running = 1; 
+            guest_running = 1; 
+            return; 
+        case 'D': 
+            put_packet("OK"); 
+            detach(); 
+            running = 1; 
+            return; 
+        case 'k': 
+            exit(0); 
+        case 'q': 
+            if(strncmp(packet, "qSupported", 10) == 0) { 
+                put_packet("PacketSize=1000"); 
+            }else if(strcmp(packet, "qAttached") == 0) { 
+                put_packet("1"); 
+            }else if(strcmp(packet, "qC") == 0) { 
+                put_packet("QC1"); 
+            }else { 
+                put_packet(""); 
+            }
+            break; 
+        case 'H': 
+            put_packet("OK"); 
+            break; 
+        default: 
+            put_packet(""); 
+            break; 
+        }
+    }
+    running = 1; 
+}
+
+/*
+ * SIGIO. Without a client : a connection on the listening socket, leave the fetch/execute
+ * loop so gdb_poll() accepts it. With one : data ( ctrl-c ) from gdb while the guest runs,
+ * stop after the current instruction.
+ */
+static void handle_io(int signal) { 
+    (void) signal; 
+    if(client < 0) { 
+        connect_pending = 1; 
+        running = 0; 
+    }else if(guest_running) { 
+        guest_running = 0; 
+        debug_stop = DEBUG_STOP_INTERRUPT; 
+        running = 0; 
+    }
+}
+
+static void async_io(int fd) { 
+    fcntl(fd, F_SETOWN, getpid()); 
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_ASYNC); 
+}
+
+// take a waiting connection, 0 when there is none
+static int attach(int stop) { 
+    int fd = accept(server, NULL, NULL); 
+    if(fd < 0) return 0; 
+    int yes = 1; 
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)); 
+    client = fd; 
+    async_io(client); 
+    debug_stop = stop; 
+    serve(); 
+    return 1; 
+}
+
+// listen on 127.0.0.1:port, with wait the guest stays at its first instruction until gdb is there
+int gdb_listen(uint16_t port, int wait) { 
+    server = socket(AF_INET, SOCK_STREAM, 0); 
+    if(server < 0) return 0; 
+    int yes = 1; 
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)); 
+    struct sockaddr_in address; 
+    memset(&address, 0, sizeof(address)); 
+    address.sin_family = AF_INET; 
+    address.sin_port = htons(port); 
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK); 
+    if(bind(server, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(server, 1) < 0) { 
+        close(server); 
+        server = -1; 
+        return 0; 
+    }
+    fcntl(server, F_SETFL, fcntl(server, F_GETFL) | O_NONBLOCK); 
+    signal(SIGIO, handle_io); 
+    async_io(server); 
+    if(!wait) return 1; 
+
+    printf("waiting for gdb on port %u\n", port); 
+    fflush(stdout); 
+    struct pollfd waiting = { .fd = server, .events = POLLIN }; 
+    do { 
+        connect_pending = 0; 
+        if(poll(&waiting, 1, -1) < 0) continue; 
+    }while(!attach(DEBUG_STOP_BREAKPOINT)); 
+    return 1; 
+}
+
+// the fetch/execute loop stopped : attach gdb if it is connecting
+void gdb_poll() { 
+    if(!connect_pending || client >= 0) return; 
+    connect_pending = 0; 
+    attach(DEBUG_STOP_INTERRUPT); 
+}
+
+int gdb_attached() { 
+    return client >= 0; 
+}
+
+// the fetch/execute loop stopped with debug_stop set
+void gdb_stopped() { 
+    guest_running = 0; 
+    if(client < 0) { 
+        debug_stop = DEBUG_STOP_NONE; 
+        return; 
+    }
+    report_stop(); 
+    serve(); 
+}
+
+// the program halted
+void gdb_exited() { 
+    if(client < 0) return; 
+    guest_running = 0; 
+    put_packet("W00"); 
+    close(client); 
+    client = -1; 
+}
@@ -0,0 +1,23 @@
+#ifndef _GDB_STUB
+#define _GDB_STUB
+
+#include<stdint.h> 
+
+/*
+ * GDB remote serial protocol stub on a local TCP port.
+ *
+ * Registers are R0-R7, PC and COND ( 16 bit, in that order ).
+ * GDB addresses are in bytes : word address * 2, words are little endian.
+ * Nothing runs per instruction while the program runs, see core/debug.h
+ *
+ * The listening socket raises SIGIO ( O_ASYNC ) : the guest runs the plain fetch/execute
+ * loop until gdb connects, the signal clears running and gdb_poll() attaches it with the
+ * guest stopped where it was. After a detach the plain loop takes over again.
+ */
+int gdb_listen(uint16_t port, int wait); 
+void gdb_poll(); 
+int gdb_attached(); 
+void gdb_stopped(); 
+void gdb_exited(); 
+
+#endif
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "./core/core.h"
+#include "hle.h"
+#include "execute.h"
+
+struct hle_routine { 
+    const char* name; 
+    uint16_t length; 
+    const uint16_t* code; 
+    // 1 : registers hold the routine's results, 0 : declined, the guest code runs
+    int (*run)(); 
+    uint64_t hash; 
+    uint64_t calls; 
+    uint64_t declined; 
+    uint64_t mismatches; 
+    int disabled; 
+}; 
+
+/*
+ * R0 = R1 * R2 ( low 16 bits ), shift and add over the 16 bits of R2.
+ * Leaves R3 = R2 & x8000 ( last bit tested ), R4 = R1 shifted out = 0, R5 = mask = 0.
+ */
+static const uint16_t mul_code[] = { 
+    0x5020,     // AND R0, R0, #0
+    0x1860,     // ADD R4, R1, #0
+    0x5B60,     // AND R5, R5, #0
+    0x1B61,     // ADD R5, R5, #1
+    0x5685,     // loop : AND R3, R2, R5
+    0x0401,     // BRz skip
+    0x1004,     // ADD R0, R0, R4
+    0x1904,     // skip : ADD R4, R4, R4
+    0x1B45,     // ADD R5, R5, R5
+    0x0BFA,     // BRnp loop
+    0x1020,     // ADD R0, R0, #0
+    0xC1C0,     // RET
+}; 
+
+static int mul_run() { 
+    uint16_t product = (uint32_t) registers[R_R1] * registers[R_R2]; 
+    registers[R_R3] = registers[R_R2] & 0x8000; 
+    registers[R_R4] = 0; 
+    registers[R_R5] = 0; 
+    registers[R_R0] = product; 
+    update_flags(R_R0); 
+    return 1; 
+}
+
+/*
+ * R0 = R1 / R2, R3 = R1 % R2 by repeated subtraction, R4 = -R2.
+ * Only for R1 >= 0 and R2 > 0 : the loop never ends for R2 = 0 and wraps for negative values.
+ */
+static const uint16_t div_code[] = { 
+    0x5020,     // AND R0, R0, #0
+    0x98BF,     // NOT R4, R2
+    0x1921,     // ADD R4, R4, #1
+    0x1660,     // ADD R3, R1, #0
+    0x16C4,     // loop : ADD R3, R3, R4
+    0x0802,     // BRn done
+    0x1021,     // ADD R0, R0, #1
+    0x0FFC,     // BRnzp loop
+    0x16C2,     // done : ADD R3, R3, R2
+    0x1020,     // ADD R0, R0, #0
+    0xC1C0,     // RET
+}; 
+
+static int div_run() { 
+    int16_t dividend = registers[R_R1], divisor = registers[R_R2]; 
+    if(dividend < 0 || divisor <= 0) return 0; 
+    registers[R_R0] = dividend / divisor; 
+    registers[R_R3] = dividend % divisor; 
+    registers[R_R4] = -divisor; 
+    update_flags(R_R0); 
+    return 1; 
+}
+
+/*
+ * R0 = R1 >> 1 ( logical ), copying bits 1-15 one at a time.
+ * Leaves R3 = source mask = 0, R4 = destination mask = x8000, R5 = R1 & x8000.
+ */
+static const uint16_t shift_right_code[] = { 
+    0x5020,     // AND R0, R0, #0
+    0x56E0,     // AND R3, R3, #0
+    0x16E2,     // ADD R3, R3, #2
+    0x5920,     // AND R4, R4, #0
+    0x1921,     // ADD R4, R4, #1
+    0x5A43,     // loop : AND R5, R1, R3
+    0x0401,     // BRz skip
+    0x1004,     // ADD R0, R0, R4
+    0x1904,     // skip : ADD R4, R4, R4
+    0x16C3,     // ADD R3, R3, R3
+    0x0BFA,     // BRnp loop
+    0x1020,     // ADD R0, R0, #0
+    0xC1C0,     // RET
+}; 
+
+static int shift_right_run() { 
+    registers[R_R0] = registers[R_R1] >> 1; 
+    registers[R_R3] = 0; 
+    registers[R_R4] = 0x8000; 
+    registers[R_R5] = registers[R_R1] & 0x8000; 
+    update_flags(R_R0); 
+    return 1; 
+}
+
+#define ROUTINE(name, code, run) { name, sizeof(code) / sizeof(code[0]), code, run, 0, 0, 0, 0, 0 }
+
+static struct hle_routine routines[] = { 
+    ROUTINE("mul", mul_code, mul_run),
+    ROUTINE("div", div_code, div_run),
+    ROUTINE("shift_right", shift_right_code, shift_right_run),
+}; 
+
+enum { 
+    ROUTINE_COUNT = sizeof(routines) / sizeof(routines[0]),
+    UNKNOWN = 0,
+    NO_ROUTINE = 1,   // known[] : 2 + index of the routine
+}; 
+
+static uint8_t known[UINT16_MAX + 1]; 
+static uint8_t bound[UINT16_MAX + 1];   // --hle-map : 1 + index of the routine
+static int hashed; 
+
+static uint64_t hash_words(const uint16_t* words, size_t count) { 
+    uint64_t hash = 0xCBF29CE484222325ull; 
+    for(size_t i = 0; i < count; ++i) { 
+        hash = (hash ^ words[i]) * 0x100000001B3ull; 
+    }
+    return hash; 
+}
+
+static int find_routine(const char* name) { 
+    for(int i = 0; i < ROUTINE_COUNT; ++i) { 
+        if(strcmp(routines[i].name, name) == 0) return i; 
+    }
+    return -1; 
+}
+
+int hle_load_map(const char* path) { 
+    FILE* file = fopen(path, "r"); 
+    if(!file) return 0; 
+    char line[256], name[64]; 
+    unsigned address; 
+    int ok = 1; 
+    while(fgets(line, sizeof(line), file)) { 
+        char* comment = strchr(line, '#'); 
+        if(comment) *comment = '\0'; 
+        if(sscanf(line, " %63s", name) != 1) continue; 
+        int routine = -1; 
+        if(sscanf(line, " %x %63s", &address, name) == 2) routine = find_routine(name); 
+        if(routine < 0 || address > UINT16_MAX) { 
+            fprintf(stderr, "hle map : bad line : %s", line); 
+            ok = 0; 
+            continue; 
+        }
+        bound[address] = routine + 1; 
+    }
+    fclose(file); 
+    return ok; 
+}
+
+// stores since the last look : forget the targets of that page and of the one before
+static void forget_written(uint16_t page) { 
+    if(!(dirty_pages[page] & DIRTY_HLE)) return; 
+    dirty_pages[page] &= ~DIRTY_HLE; 
+    memset(known + ((size_t) page << PAGE_SHIFT), UNKNOWN, PAGE_SIZE); 
+    memset(known + ((size_t) ((page - 1) & (PAGE_COUNT - 1)) << PAGE_SHIFT), UNKNOWN, PAGE_SIZE); 
+}
+
+static int identify(uint16_t target) { 
+    if(!hashed) { 
+        for(int i = 0; i < ROUTINE_COUNT; ++i) routines[i].hash = hash_words(routines[i].code, routines[i].length); 
+        hashed = 1; 
+    }
+    for(int i = 0; i < ROUTINE_COUNT; ++i) { 
+        const struct hle_routine* routine = &routines[i]; 
+        uint32_t end = (uint32_t) target + routine->length; 
+        if(end > UINT16_MAX + 1) continue; 
+        if(hash_words(memory + target, routine->length) != routine->hash) continue; 
+        if(memcmp(memory + target, routine->code, routine->length * sizeof(uint16_t)) != 0) continue; 
+        return i; 
+    }
+    return -1; 
+}
+
+/*
+ * Only code on plain pages ( a hot trace's PAGE_CODE is fine ), checked on every call : a
+ * breakpoint or watchpoint set after the first call does not store through mem_write().
+ * HLE_MAX_LENGTH words from the target cover any registered routine and a bound one.
+ */
+static int plain(uint16_t target) { 
+    uint16_t last = target + HLE_MAX_LENGTH - 1 < UINT16_MAX ? target + HLE_MAX_LENGTH - 1 : UINT16_MAX; 
+    return !((page_attributes[target >> PAGE_SHIFT] | page_attributes[last >> PAGE_SHIFT]) & ~PAGE_CODE); 
+}
+
+static int lookup(uint16_t target) { 
+    if(bound[target]) return bound[target] - 1; 
+    uint16_t page = target >> PAGE_SHIFT; 
+    forget_written(page); 
+    forget_written((page + 1) & (PAGE_COUNT - 1)); 
+    if(known[target] == UNKNOWN) { 
+        int routine = identify(target); 
+        known[target] = routine < 0 ? NO_ROUTINE : 2 + routine; 
+    }
+    return known[target] == NO_ROUTINE ? -1 : known[target] - 2; 
+}
+
+static const char* register_names[R_COUNT] = { "R0", "R1", "R2", "R3", "R4", "R5", "R6", "R7", "PC", "COND" }; 
+
+/*
+ * Native first, then the guest code from the same state, the guest's result is kept.
+ * HLE is off while the guest code runs : a JSR in it to another registered routine is
+ * interpreted and does not come back here over the buffers of this call.
+ */
+static void verify(struct hle_routine* routine) { 
+    static uint16_t entry_memory[UINT16_MAX + 1], native_memory[UINT16_MAX + 1]; 
+    uint16_t entry[R_COUNT], native[R_COUNT]; 
+    uint16_t target = registers[R_PC]; 
+    memcpy(entry, registers, sizeof(entry)); 
+    memcpy(entry_memory, memory, sizeof(entry_memory)); 
+    if(!routine->run()) { 
+        ++routine->declined; 
+        return; 
+    }
+    ++routine->calls; 
+    registers[R_PC] = registers[R_R7]; 
+    memcpy(native, registers, sizeof(native)); 
+    memcpy(native_memory, memory, sizeof(native_memory)); 
+    memcpy(registers, entry, sizeof(entry)); 
+    memcpy(memory, entry_memory, sizeof(entry_memory)); 
+
+    uint16_t return_address = registers[R_R7]; 
+    uint32_t steps = 0; 
+    hle_enabled = 0; 
+    while(registers[R_PC] != return_address && !halted && steps < HLE_VERIFY_MAX_STEPS) { 
+        fetchExecute(); 
+        ++steps; 
+    }
+    hle_enabled = 1; 
+    if(halted) return; 
+    if(registers[R_PC] != return_address) { 
+        fprintf(stderr, "hle : %s at x%04X did not return\n", routine->name, target); 
+        return; 
+    }
+
+    int differs = 0; 
+    for(int r = 0; r < R_COUNT; ++r) { 
+        if(registers[r] == native[r]) continue; 
+        fprintf(stderr, "hle : %s at x%04X : %s guest x%04X native x%04X\n", routine->name, target, register_names[r], registers[r], native[r]); 
+        differs = 1; 
+    }
+    for(uint32_t address = 0; address <= UINT16_MAX; ++address) { 
+        if(memory[address] == native_memory[address]) continue; 
+        fprintf(stderr, "hle : %s at x%04X : memory x%04X guest x%04X native x%04X\n", routine->name, target, address, memory[address], native_memory[address]); 
+        differs = 1; 
+        break; 
+    }
+    if(differs) { 
+        ++routine->mismatches; 
+        routine->disabled = 1; 
+    }
+}
+
+// called by jumpToSubroutine() with PC at the target and R7 holding the return address
+void hle_call() { 
+    if(!plain(registers[R_PC])) return; 
+    int index = lookup(registers[R_PC]); 
+    if(index < 0) return; 
+    struct hle_routine* routine = &routines[index]; 
+    if(routine->disabled) return; 
+    if(hle_verify) { 
+        verify(routine); 
+        return; 
+    }
+    if(!routine->run()) { 
+        ++routine->declined; 
+        return; 
+    }
+    ++routine->calls; 
+    registers[R_PC] = registers[R_R7]; 
+}
+
+void hle_report() { 
+    for(int i = 0; i < ROUTINE_COUNT; ++i) { 
+        const struct hle_routine* routine = &routines[i]; 
+        fprintf(stderr, "hle : %-12s calls %llu declined %llu mismatches %llu\n", routine->name,
+                (unsigned long long) routine->calls, (unsigned long long) routine->declined, (unsigned long long) routine->mismatches); 
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef _HLE
+#define _HLE
+
+#include<stdint.h>
+
+/*
+ * High level emulation of guest library routines ( lc3 --hle ).
+ *
+ * LC-3 has no multiply, divide or shift, guests call loops of a hundred instructions and
+ * more for them. After a JSR / JSRR the code at the target is compared with the routines
+ * in the registry ( a hash of the routine's words, then the words themselves ), a match
+ * runs as host code with the same effect on R0-R7 and COND the loop would have had and
+ * returns to R7 at once. Only the JSR counts as a retired instruction.
+ *
+ * The result of the lookup is kept per target. Stores to a page drop what is known about
+ * the targets on it and the page before ( DIRTY_HLE ), so patched code is looked at again.
+ * Routines on pages with attributes ( breakpoints, devices, compressed ... ) are interpreted.
+ *
+ * A native routine may decline arguments where the guest loop would not terminate or
+ * behaves differently ( divide by zero ... ), the guest code then runs as usual.
+ *
+ * --hle-map=FILE binds routines to addresses whatever code is there, one "ADDRESS NAME"
+ * per line ( hex address, # starts a comment ), for guests whose routine differs in code
+ * but keeps the same interface. --hle-verify runs the guest code after every native call
+ * and reports to stderr any register, COND, PC or memory difference, the routine is then
+ * disabled. The guest's result is the one kept.
+ */
+enum { 
+    HLE_MAX_LENGTH        = 64,       // words after a target that must be on plain pages, covers every routine
+    HLE_VERIFY_MAX_STEPS  = 1 << 20,  // guest instructions allowed to reach R7 when verifying
+}; 
+
+int hle_enabled; 
+int hle_verify; 
+
+int hle_load_map(const char* path); 
+void hle_call(); 
+void hle_report(); 
+
+#endif
@@ -0,0 +1,636 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "./core/core.h"
+#include "./core/opcodes.h"
+#include "./core/bit-utilities.h"
+#include "execute.h"
+#include "hot-trace.h"
+
+// IR operations, every node but a store or a guard defines the slot it names
+enum { 
+    HOT_ADD = 0,
+    HOT_AND,
+    HOT_NOT,
+    HOT_LOAD,   // exits when the page has attributes other than PAGE_CODE
+    HOT_STORE,  // exits when the page has any attribute but PAGE_CODE, or the word is traced code
+    HOT_GUARD,  // exits when the branch goes the other way than recorded
+}; 
+
+// slot kinds while building : slots 0-7 are R0-R7 at the start of an iteration
+enum { 
+    SLOT_REGISTER = 0,
+    SLOT_CONSTANT,
+    SLOT_NODE,
+}; 
+
+enum { 
+    NO_REGISTER = 0xFF,
+}; 
+
+struct hot_node { 
+    uint8_t op; 
+    uint8_t reg;     // guard : register whose value sets COND first, NO_REGISTER = COND is already right
+    uint16_t slot; 
+    uint16_t a; 
+    uint16_t b;      // guard : 1 = recorded taken
+    uint16_t value;  // guard : n z p bits
+    uint16_t exit; 
+}; 
+
+// architectural state to restore when leaving the trace
+struct hot_exit { 
+    uint16_t pc; 
+    uint16_t regs[8];       // slot holding each register
+    uint8_t cond_reg;       // COND is set from this register, NO_REGISTER = already right
+    uint16_t instructions;  // retired since the start of the iteration
+    uint16_t loads; 
+    uint16_t stores; 
+    uint16_t branches; 
+}; 
+
+struct hot_trace { 
+    uint16_t head; 
+    uint16_t slot_count; 
+    uint16_t node_count; 
+    uint16_t constant_count; 
+    struct hot_node* nodes; 
+    struct hot_exit* exits; 
+    uint16_t* constant_slots; 
+    uint16_t* constant_values; 
+    struct hot_exit loop;   // end of an iteration, regs are the values of the next one
+    uint16_t code[HOT_MAX_INSTRUCTIONS];  // addresses of the traced instructions
+    int code_count; 
+    struct hot_trace* next; 
+}; 
+
+static struct hot_trace* traces[UINT16_MAX + 1]; 
+static struct hot_trace* trace_list; 
+
+// traces holding each word, traced words in each page ( PAGE_CODE is set while non zero )
+static uint16_t code_words[UINT16_MAX + 1]; 
+static uint16_t code_pages[PAGE_COUNT]; 
+
+// taken backward branches per target, HOT_BLOCKED = recording failed there
+enum { HOT_BLOCKED = UINT16_MAX }; 
+static uint16_t heat[UINT16_MAX + 1]; 
+
+// instructions seen while recording
+static struct { 
+    int active; 
+    uint16_t head; 
+    int length; 
+    uint16_t pc[HOT_MAX_INSTRUCTIONS]; 
+    uint16_t instruction[HOT_MAX_INSTRUCTIONS]; 
+    uint16_t next[HOT_MAX_INSTRUCTIONS]; 
+} recording; 
+
+/*
+ * Trace builder.
+ */
+static struct { 
+    int failed; 
+    struct hot_node nodes[HOT_MAX_NODES]; 
+    int node_count; 
+    struct hot_exit exits[2 * HOT_MAX_INSTRUCTIONS]; 
+    int exit_count; 
+
+    uint16_t slot_count; 
+    uint8_t kind[HOT_MAX_SLOTS]; 
+    uint16_t constant[HOT_MAX_SLOTS];   // SLOT_CONSTANT : its value
+    int16_t node[HOT_MAX_SLOTS];        // SLOT_NODE : the node defining it
+
+    uint16_t regs[8]; 
+    uint8_t pending;                    // last register written since COND was last computed
+
+    uint16_t instructions; 
+    uint16_t loads; 
+    uint16_t stores; 
+    uint16_t branches; 
+
+    // memory contents known in this iteration : address slot -> value slot
+    uint16_t known_address[HOT_MAX_NODES]; 
+    uint16_t known_value[HOT_MAX_NODES]; 
+    int known_count; 
+} build; 
+
+static uint16_t new_slot(uint8_t kind) { 
+    if(build.slot_count == HOT_MAX_SLOTS) { 
+        build.failed = 1; 
+        return 0; 
+    }
+    build.kind[build.slot_count] = kind; 
+    return build.slot_count++; 
+}
+
+static uint16_t constant(uint16_t value) { 
+    for(uint16_t slot = 8; slot < build.slot_count; ++slot) { 
+        if(build.kind[slot] == SLOT_CONSTANT && build.constant[slot] == value) return slot; 
+    }
+    uint16_t slot = new_slot(SLOT_CONSTANT); 
+    build.constant[slot] = value; 
+    return slot; 
+}
+
+static int is_constant(uint16_t slot) { 
+    return build.kind[slot] == SLOT_CONSTANT; 
+}
+
+static struct hot_node* emit(uint8_t op, uint16_t a, uint16_t b) { 
+    if(build.node_count == HOT_MAX_NODES) { 
+        build.failed = 1; 
+        build.node_count = 0; 
+    }
+    struct hot_node* node = &build.nodes[build.node_count]; 
+    memset(node, 0, sizeof(*node)); 
+    node->op = op; 
+    node->a = a; 
+    node->b = b; 
+    if(op != HOT_STORE && op != HOT_GUARD) { 
+        node->slot = new_slot(SLOT_NODE); 
+        build.node[node->slot] = build.node_count; 
+    }
+    ++build.node_count; 
+    return node; 
+}
+
+// node defining slot, NULL for registers and constants
+static struct hot_node* definition(uint16_t slot) { 
+    return build.kind[slot] == SLOT_NODE ? &build.nodes[build.node[slot]] : NULL; 
+}
+
+static uint16_t add(uint16_t a, uint16_t b) { 
+    if(is_constant(a)) { 
+        uint16_t swap = a; 
+        a = b; 
+        b = swap; 
+    }
+    if(is_constant(b)) { 
+        if(is_constant(a)) return constant(build.constant[a] + build.constant[b]); 
+        if(build.constant[b] == 0) return a; 
+        // ( x + c1 ) + c2 = x + ( c1 + c2 )
+        struct hot_node* inner = definition(a); 
+        if(inner && inner->op == HOT_ADD && is_constant(inner->b)) { 
+            return add(inner->a, constant(build.constant[inner->b] + build.constant[b])); 
+        }
+    }
+    return emit(HOT_ADD, a, b)->slot; 
+}
+
+static uint16_t and(uint16_t a, uint16_t b) { 
+    if(is_constant(a)) { 
+        uint16_t swap = a; 
+        a = b; 
+        b = swap; 
+    }
+    if(a == b) return a; 
+    if(is_constant(b)) { 
+        if(is_constant(a)) return constant(build.constant[a] & build.constant[b]); 
+        if(build.constant[b] == 0xFFFF) return a; 
+        if(build.constant[b] == 0) return b; 
+    }
+    return emit(HOT_AND, a, b)->slot; 
+}
+
+static uint16_t not(uint16_t a) { 
+    if(is_constant(a)) return constant(~build.constant[a]); 
+    struct hot_node* inner = definition(a); 
+    if(inner && inner->op == HOT_NOT) return inner->a; 
+    return emit(HOT_NOT, a, 0)->slot; 
+}
+
+static void remember(uint16_t address, uint16_t value) { 
+    build.known_address[build.known_count] = address; 
+    build.known_value[build.known_count] = value; 
+    ++build.known_count; 
+}
+
+// redundant loads : same address slot ( constants are shared, so same constant address too )
+static uint16_t load(uint16_t address, uint16_t exit) { 
+    for(int i = build.known_count - 1; i >= 0; --i) { 
+        if(build.known_address[i] == address) return build.known_value[i]; 
+    }
+    struct hot_node* node = emit(HOT_LOAD, address, 0); 
+    node->exit = exit; 
+    uint16_t slot = node->slot; 
+    remember(address, slot); 
+    return slot; 
+}
+
+static void store(uint16_t address, uint16_t value, uint16_t exit) { 
+    emit(HOT_STORE, address, value)->exit = exit; 
+    // a constant address only overwrites itself, anything else may alias every address
+    int kept = 0; 
+    for(int i = 0; i < build.known_count; ++i) { 
+        uint16_t known = build.known_address[i]; 
+        if(is_constant(address) && is_constant(known) && known != address) { 
+            build.known_address[kept] = known; 
+            build.known_value[kept] = build.known_value[i]; 
+            ++kept; 
+        }
+    }
+    build.known_count = kept; 
+    remember(address, value); 
+}
+
+static void set_register(uint16_t r, uint16_t slot) { 
+    build.regs[r] = slot; 
+    build.pending = r; 
+}
+
+static void snapshot(struct hot_exit* exit, uint16_t pc) { 
+    exit->pc = pc; 
+    memcpy(exit->regs, build.regs, sizeof(exit->regs)); 
+    exit->cond_reg = build.pending; 
+    exit->instructions = build.instructions; 
+    exit->loads = build.loads; 
+    exit->stores = build.stores; 
+    exit->branches = build.branches; 
+}
+
+// state before the instruction at pc
+static uint16_t exit_before(uint16_t pc) { 
+    if(build.exit_count == sizeof(build.exits) / sizeof(build.exits[0])) { 
+        build.failed = 1; 
+        return 0; 
+    }
+    snapshot(&build.exits[build.exit_count], pc); 
+    return build.exit_count++; 
+}
+
+static void translate(uint16_t pc, uint16_t instruction, uint16_t next) { 
+    uint16_t r0 = (instruction >> 9) & 0x7; 
+    uint16_t r1 = (instruction >> 6) & 0x7; 
+    uint16_t pc_relative = pc + 1 + sign_extend(instruction & 0x1FF, 9); 
+    uint16_t offset6 = constant(sign_extend(instruction & 0x3F, 6)); 
+    uint16_t operand = (instruction >> 5) & 0x1 ? constant(sign_extend(instruction & 0x1F, 5)) : build.regs[instruction & 0x7]; 
+
+    switch(instruction >> 12) { 
+    case OP_ADD:
+        set_register(r0, add(build.regs[r1], operand)); 
+        break; 
+    case OP_AND:
+        set_register(r0, and(build.regs[r1], operand)); 
+        break; 
+    case OP_NOT:
+        set_register(r0, not(build.regs[r1])); 
+        break; 
+    case OP_LEA:
+        set_register(r0, constant(pc_relative)); 
+        break; 
+    case OP_LD: { 
+        uint16_t exit = exit_before(pc); 
+        set_register(r0, load(constant(pc_relative), exit)); 
+        ++build.loads; 
+        break; 
+    }
+    case OP_LDI: { 
+        uint16_t exit = exit_before(pc); 
+        set_register(r0, load(load(constant(pc_relative), exit), exit)); 
+        ++build.loads; 
+        break; 
+    }
+    case OP_LDR: { 
+        uint16_t exit = exit_before(pc); 
+        set_register(r0, load(add(build.regs[r1], offset6), exit)); 
+        ++build.loads; 
+        break; 
+    }
+    case OP_ST: { 
+        uint16_t exit = exit_before(pc); 
+        store(constant(pc_relative), build.regs[r0], exit); 
+        ++build.stores; 
+        break; 
+    }
+    case OP_STI: { 
+        uint16_t exit = exit_before(pc); 
+        store(load(constant(pc_relative), exit), build.regs[r0], exit); 
+        ++build.stores; 
+        break; 
+    }
+    case OP_STR: { 
+        uint16_t exit = exit_before(pc); 
+        store(add(build.regs[r1], offset6), build.regs[r0], exit); 
+        ++build.stores; 
+        break; 
+    }
+    case OP_BR: { 
+        uint16_t conditions = (instruction >> 9) & 0x7; 
+        // never taken, or taken to the next instruction anyway
+        if(!conditions || pc_relative == (uint16_t)(pc + 1)) break; 
+        int taken = next != (uint16_t)(pc + 1); 
+        struct hot_node* guard = emit(HOT_GUARD, 0, taken); 
+        guard->value = conditions; 
+        guard->reg = build.pending; 
+        if(build.pending != NO_REGISTER) guard->a = build.regs[build.pending]; 
+        build.pending = NO_REGISTER; 
+        // the other direction, with the branch retired
+        ++build.instructions; 
+        if(!taken) ++build.branches; 
+        guard->exit = exit_before(taken ? pc + 1 : pc_relative); 
+        --build.instructions; 
+        if(!taken) --build.branches; 
+        if(taken) ++build.branches; 
+        break; 
+    }
+    default:
+        build.failed = 1; 
+        break; 
+    }
+    ++build.instructions; 
+}
+
+// drop arithmetic nobody reads
+static void eliminate_dead_nodes(struct hot_exit* loop) { 
+    uint8_t live[HOT_MAX_SLOTS] = { 0 }; 
+    for(int r = 0; r < 8; ++r) live[loop->regs[r]] = 1; 
+    for(int e = 0; e < build.exit_count; ++e) { 
+        for(int r = 0; r < 8; ++r) live[build.exits[e].regs[r]] = 1; 
+    }
+    for(int n = build.node_count - 1; n >= 0; --n) { 
+        struct hot_node* node = &build.nodes[n]; 
+        switch(node->op) { 
+        case HOT_ADD:
+        case HOT_AND:
+            if(!live[node->slot]) { 
+                node->op = 0xFF; 
+                break; 
+            }
+            live[node->a] = live[node->b] = 1; 
+            break; 
+        case HOT_NOT:
+            if(!live[node->slot]) { 
+                node->op = 0xFF; 
+                break; 
+            }
+            live[node->a] = 1; 
+            break; 
+        case HOT_LOAD:
+            live[node->a] = 1; 
+            break; 
+        case HOT_STORE:
+            live[node->a] = live[node->b] = 1; 
+            break; 
+        case HOT_GUARD:
+            if(node->reg != NO_REGISTER) live[node->a] = 1; 
+            break; 
+        }
+    }
+    int kept = 0; 
+    for(int n = 0; n < build.node_count; ++n) { 
+        if(build.nodes[n].op != 0xFF) build.nodes[kept++] = build.nodes[n]; 
+    }
+    build.node_count = kept; 
+}
+
+static struct hot_trace* compile() { 
+    memset(&build, 0, sizeof(build)); 
+    for(int r = 0; r < 8; ++r) { 
+        build.regs[r] = new_slot(SLOT_REGISTER); 
+    }
+    build.pending = NO_REGISTER; 
+    for(int i = 0; i < recording.length && !build.failed; ++i) { 
+        // the code changed since it ran
+        if(memory[recording.pc[i]] != recording.instruction[i]) return NULL; 
+        translate(recording.pc[i], recording.instruction[i], recording.next[i]); 
+    }
+    if(build.failed) return NULL; 
+
+    struct hot_trace* trace = calloc(1, sizeof(*trace)); 
+    if(!trace) return NULL; 
+    trace->head = recording.head; 
+    snapshot(&trace->loop, recording.head); 
+    eliminate_dead_nodes(&trace->loop); 
+
+    trace->slot_count = build.slot_count; 
+    trace->node_count = build.node_count; 
+    trace->nodes = malloc(build.node_count * sizeof(struct hot_node) + 1); 
+    trace->exits = malloc(build.exit_count * sizeof(struct hot_exit) + 1); 
+    trace->constant_slots = malloc(build.slot_count * sizeof(uint16_t)); 
+    trace->constant_values = malloc(build.slot_count * sizeof(uint16_t)); 
+    memcpy(trace->nodes, build.nodes, build.node_count * sizeof(struct hot_node)); 
+    memcpy(trace->exits, build.exits, build.exit_count * sizeof(struct hot_exit)); 
+    for(uint16_t slot = 8; slot < build.slot_count; ++slot) { 
+        if(build.kind[slot] != SLOT_CONSTANT) continue; 
+        trace->constant_slots[trace->constant_count] = slot; 
+        trace->constant_values[trace->constant_count] = build.constant[slot]; 
+        ++trace->constant_count; 
+    }
+    memcpy(trace->code, recording.pc, recording.length * sizeof(uint16_t)); 
+    trace->code_count = recording.length; 
+    return trace; 
+}
+
+static void install(struct hot_trace* trace) { 
+    for(int i = 0; i < trace->code_count; ++i) { 
+        uint16_t address = trace->code[i]; 
+        if(!code_words[address]++ && !code_pages[address >> PAGE_SHIFT]++) { 
+            page_attributes[address >> PAGE_SHIFT] |= PAGE_CODE; 
+        }
+    }
+    traces[trace->head] = trace; 
+    trace->next = trace_list; 
+    trace_list = trace; 
+}
+
+static void release(struct hot_trace* trace) { 
+    for(int i = 0; i < trace->code_count; ++i) { 
+        uint16_t address = trace->code[i]; 
+        if(!--code_words[address] && !--code_pages[address >> PAGE_SHIFT]) { 
+            page_attributes[address >> PAGE_SHIFT] &= ~PAGE_CODE; 
+        }
+    }
+    free(trace->nodes); 
+    free(trace->exits); 
+    free(trace->constant_slots); 
+    free(trace->constant_values); 
+    free(trace); 
+}
+
+// a store hit a page holding traced code, drop the traces holding that word
+void hot_invalidate(uint16_t address) { 
+    if(!code_words[address]) return; 
+    struct hot_trace** link = &trace_list; 
+    while(*link) { 
+        struct hot_trace* trace = *link; 
+        int hit = 0; 
+        for(int i = 0; i < trace->code_count; ++i) { 
+            if(trace->code[i] == address) hit = 1; 
+        }
+        if(!hit) { 
+            link = &trace->next; 
+            continue; 
+        }
+        *link = trace->next; 
+        traces[trace->head] = NULL; 
+        heat[trace->head] = 0; 
+        release(trace); 
+    }
+    // a recording through this word may hold a stale copy, compile() checks them
+}
+
+static void leave(const struct hot_exit* exit, const uint16_t* v) { 
+    for(int r = 0; r < 8; ++r) { 
+        registers[r] = v[exit->regs[r]]; 
+    }
+    if(exit->cond_reg != NO_REGISTER) update_flags(exit->cond_reg); 
+    registers[R_PC] = exit->pc; 
+    instructions_retired += exit->instructions; 
+    if(perf_counting) { 
+        perf_counters[PERF_LOADS] += exit->loads; 
+        perf_counters[PERF_STORES] += exit->stores; 
+        perf_counters[PERF_BRANCHES] += exit->branches; 
+    }
+}
+
+// run iterations until an exit is taken or running is cleared
+static void execute(const struct hot_trace* trace) { 
+    uint16_t v[HOT_MAX_SLOTS]; 
+    for(int r = 0; r < 8; ++r) { 
+        v[r] = registers[r]; 
+    }
+    for(int i = 0; i < trace->constant_count; ++i) { 
+        v[trace->constant_slots[i]] = trace->constant_values[i]; 
+    }
+    const struct hot_node* end = trace->nodes + trace->node_count; 
+    const struct hot_exit* exit; 
+
+    while(1) { 
+        for(const struct hot_node* node = trace->nodes; node < end; ++node) { 
+            switch(node->op) { 
+            case HOT_ADD:
+                v[node->slot] = v[node->a] + v[node->b]; 
+                break; 
+            case HOT_AND:
+                v[node->slot] = v[node->a] & v[node->b]; 
+                break; 
+            case HOT_NOT:
+                v[node->slot] = ~v[node->a]; 
+                break; 
+            case HOT_LOAD: { 
+                uint16_t address = v[node->a]; 
+                if(page_attributes[address >> PAGE_SHIFT] & ~PAGE_CODE) { 
+                    exit = &trace->exits[node->exit]; 
+                    goto done; 
+                }
+                v[node->slot] = memory[address]; 
+                break; 
+            }
+            case HOT_STORE: { 
+                uint16_t address = v[node->a]; 
+                uint8_t attributes = page_attributes[address >> PAGE_SHIFT]; 
+                if(attributes && (attributes != PAGE_CODE || code_words[address])) { 
+                    exit = &trace->exits[node->exit]; 
+                    goto done; 
+                }
+                memory[address] = v[node->b]; 
+                dirty_pages[address >> PAGE_SHIFT] = DIRTY_ALL; 
+                break; 
+            }
+            case HOT_GUARD:
+                if(node->reg != NO_REGISTER) { 
+                    registers[node->reg] = v[node->a]; 
+                    update_flags(node->reg); 
+                }
+                if(((node->value & registers[R_COND]) != 0) != node->b) { 
+                    exit = &trace->exits[node->exit]; 
+                    goto done; 
+                }
+                break; 
+            }
+        }
+
+        // back at the head : count the iteration, COND only when the next one starts with a branch on it
+        exit = &trace->loop; 
+        if(!running) goto done; 
+        instructions_retired += exit->instructions; 
+        if(perf_counting) { 
+            perf_counters[PERF_LOADS] += exit->loads; 
+            perf_counters[PERF_STORES] += exit->stores; 
+            perf_counters[PERF_BRANCHES] += exit->branches; 
+        }
+        if(exit->cond_reg != NO_REGISTER) { 
+            registers[exit->cond_reg] = v[exit->regs[exit->cond_reg]]; 
+            update_flags(exit->cond_reg); 
+        }
+        uint16_t next[8]; 
+        for(int r = 0; r < 8; ++r) { 
+            next[r] = v[exit->regs[r]]; 
+        }
+        memcpy(v, next, sizeof(next)); 
+    }
+done:
+    leave(exit, v); 
+}
+
+static void record(uint16_t pc, uint16_t instruction) { 
+    uint16_t next = registers[R_PC]; 
+    switch(instruction >> 12) { 
+    case OP_ADD: case OP_AND: case OP_NOT: case OP_LEA:
+    case OP_LD: case OP_LDI: case OP_LDR:
+    case OP_ST: case OP_STI: case OP_STR:
+    case OP_BR:
+        break; 
+    default:
+        recording.active = 0; 
+        heat[recording.head] = HOT_BLOCKED; 
+        return; 
+    }
+    int n = recording.length++; 
+    recording.pc[n] = pc; 
+    recording.instruction[n] = instruction; 
+    recording.next[n] = next; 
+
+    if(next == recording.head) { 
+        recording.active = 0; 
+        struct hot_trace* trace = compile(); 
+        if(trace) install(trace); 
+        else heat[recording.head] = HOT_BLOCKED; 
+        return; 
+    }
+    if(recording.length == HOT_MAX_INSTRUCTIONS) { 
+        recording.active = 0; 
+        heat[recording.head] = HOT_BLOCKED; 
+    }
+}
+
+// fetch / execute loop with the trace tier, returns once running is cleared
+void hot_run() { 
+    while(running) { 
+        uint16_t pc = registers[R_PC]; 
+        const struct hot_trace* trace = traces[pc]; 
+        if(trace) { 
+            // the recording would miss what the trace runs, loops around a traced loop stay interpreted
+            if(recording.active) { 
+                recording.active = 0; 
+                heat[recording.head] = HOT_BLOCKED; 
+            }
+            execute(trace); 
+            continue; 
+        }
+        // only code on plain pages is recorded ( PAGE_CODE is ours )
+        int plain = !(page_attributes[pc >> PAGE_SHIFT] & ~PAGE_CODE); 
+        uint16_t instruction = memory[pc]; 
+        fetchExecute(); 
+
+        if(recording.active) { 
+            if(plain) { 
+                record(pc, instruction); 
+            }else { 
+                recording.active = 0; 
+                heat[recording.head] = HOT_BLOCKED; 
+            }
+            continue; 
+        }
+        uint16_t target = registers[R_PC]; 
+        if((instruction >> 12) == OP_BR && target <= pc && target != (uint16_t)(pc + 1) && plain) { 
+            if(heat[target] != HOT_BLOCKED && ++heat[target] >= HOT_THRESHOLD && !traces[target]) { 
+                recording.active = 1; 
+                recording.head = target; 
+                recording.length = 0; 
+            }
+        }
+    }
+}
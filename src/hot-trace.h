@@ -0,0 +1,39 @@
+#ifndef _HOT_TRACE
+#define _HOT_TRACE
+
+#include<stdint.h>
+
+/*
+ * Hot trace tier ( lc3 --hot-traces ).
+ *
+ * The interpreter counts taken backward branches per target. A target that gets hot is
+ * recorded while the interpreter keeps running it : the path through the loop body back
+ * to the target becomes a trace. Traces hold ADD, AND, NOT, LEA, LD, LDI, LDR, ST, STI,
+ * STR and BR, anything else ends the recording.
+ *
+ * A trace is turned into a small SSA IR and optimised :
+ *  - constants are folded, LEA / immediate / offset chains become one constant or one add
+ *  - loads of an address already loaded or stored in the same iteration are reused
+ *  - condition codes are only computed where a branch or an exit needs them
+ *  - R0-R7 stay in local slots for the whole trace, written back only on exit
+ *
+ * Every branch becomes a guard. A guard that fails, a load from a page with attributes
+ * ( devices, lazy pages, watchpoints ... ) or a store to one leaves the trace with the
+ * registers, COND, PC and counters exactly as the interpreter would have them before
+ * that instruction ( after it, for a branch ), the interpreter then carries on.
+ *
+ * Pages holding traced code get the PAGE_CODE attribute, a store to one of them goes
+ * through mem_write_slow(), which drops the traces holding the stored word. Data next to
+ * the code on the same page is still stored directly by a trace.
+ */
+enum { 
+    HOT_THRESHOLD        = 64,   // taken backward branches to a target before it is recorded
+    HOT_MAX_INSTRUCTIONS = 64,   // longest loop body
+    HOT_MAX_NODES        = 512,
+    HOT_MAX_SLOTS        = 1024,
+}; 
+
+void hot_run(); 
+void hot_invalidate(uint16_t address); 
+
+#endif
@@ -1,9 +1,14 @@
+#include "./core/bit-utilities.h"
 #include "./core/core.h"
+#include "./core/keyboard.h"
 #include "instruction-set.h"
+#include "fuzz.h"
+#include "hle.h"
 
 #include<stdio.h>
 #include<stdint.h>
 #include<stdlib.h>
+#include<string.h>
 
 // instruction 
 void add(uint16_t instruction) { 
@@ -156,10 +161,11 @@ if PC was at 0x100
     // Destination register (DR)
     uint16_t r0 = (instruction >> 9) & 0x7 ; 
     // PCoffset9
-    uint16_t pc_offet = sign_extend(instruction & 0x1FF, 9); 
+    uint16_t pc_offset = sign_extend(instruction & 0x1FF, 9); 
 
     // add pc_offset to the current PC, look at that memory location to get the final address.  
     registers[r0] = mem_read(mem_read(registers[R_PC] + pc_offset)); 
+    if(perf_counting) ++perf_counters[PERF_LOADS]; 
     update_flags(r0); 
 }
 
@@ -259,7 +265,12 @@ void branch(uint16_t instruction) {
      uint16_t conditionalFlag = (instruction >> 9) & 0x7; 
      if (conditionalFlag & registers[R_COND]) { 
          // if branch conditions are met, branch 
+         if(perf_counting) ++perf_counters[PERF_BRANCHES]; 
+         if (coverage_map) fuzz_edge(registers[R_PC] - 1, registers[R_PC] + signedExtendedpcOffset);
          registers[R_PC] += signedExtendedpcOffset ;  
+     }else if (coverage_map) { 
+         // fall through edge
+         fuzz_edge(registers[R_PC] - 1, registers[R_PC]);
      }
 }
 
@@ -269,6 +280,7 @@ void jump(uint16_t instruction) {
            RED always loads R7
      */
     uint16_t r1 = (instruction >> 6) & 0x7; 
+    if (coverage_map) fuzz_edge(registers[R_PC] - 1, registers[r1]);
     // jump to the content of the registers R1  by pointing PC to value of R1 register 
     registers[R_PC] = registers[r1]; 
 }
@@ -303,7 +315,8 @@ void jumpToSubroutine(uint16_t instruction) {
     else { 
         registers[R_PC] = registers[baseRegister];  // JSRR
     }
-    break; 
+    // a recognised library routine runs as host code and returns to R7 ( see hle.h )
+    if(hle_enabled) hle_call(); 
 }
 
 
@@ -332,7 +345,8 @@ void load(uint16_t instruction) {
     uint16_t r0 = (instruction >> 9) & 0x7; 
     uint16_t PCoffset9 = instruction & 0x1FF; 
     uint16_t pc_offset = sign_extend(PCoffset9, 9);  
-    reg[r0] = mem_read(reg[R_PC], + pc_offset); 
+    registers[r0] = mem_read(registers[R_PC] + pc_offset); 
+    if(perf_counting) ++perf_counters[PERF_LOADS]; 
     update_flags(r0);
 }
 
@@ -373,6 +387,7 @@ void loadRegister(uint16_t instruction) {
     uint16_t r1 = (instruction >> 6) & 0x7 ; 
     uint16_t offset = sign_extend(instruction & 0x3F ,6);
     registers[r0] = mem_read(registers[r1] + offset); 
+    if(perf_counting) ++perf_counters[PERF_LOADS]; 
     update_flags(r0); 
 }
 
@@ -469,7 +484,8 @@ void store(uint16_t instruction) {
 
     uint16_t r0 = (instruction >> 9) & 0x7;  
     uint16_t pc_offset = sign_extend(instruction & 0x1FF, 9);
-    mem_write(registers[R_PC] + pc_offet, registers[r0]);
+    mem_write(registers[R_PC] + pc_offset, registers[r0]);
+    if(perf_counting) ++perf_counters[PERF_STORES]; 
 }
 
 
@@ -498,8 +514,9 @@ void storeIndirect(uint16_t instruction){
 
     uint16_t r0  = (instruction >> 9) & 0x7 ; 
     uint16_t pc_offset = sign_extend(instruction & 0x1FF, 9);
-    uint16_t address = mem_read(registers[R_PC] + pc_offet); 
+    uint16_t address = mem_read(registers[R_PC] + pc_offset); 
     mem_write(address, registers[r0]); // writing address content in r0 register 
+    if(perf_counting) ++perf_counters[PERF_STORES]; 
 }
 
 void storeRegister(uint16_t instruction) { 
@@ -529,11 +546,121 @@ void storeRegister(uint16_t instruction) {
     specified by bits [8:6].
 
   */
-    uint16_t r0 = (instruction >> 8) & 0x7 ;  // source register
+    uint16_t r0 = (instruction >> 9) & 0x7 ;  // source register
     uint16_t r1 = (instruction >> 6) & 0x7 ; 
     uint16_t offset = sign_extend(instruction & 0x3F, 6); 
     uint16_t address = registers[r1]+ offset; 
     mem_write(address, registers[r0]); 
+    if(perf_counting) ++perf_counters[PERF_STORES]; 
+}
+
+/*
+ * Block operations : the source and destination ranges are cut at page boundaries.
+ * Plain pages are handled as host arrays, pages with attributes ( devices, lazy pages,
+ * watchpoints ... ) word by word through mem_read()/mem_write().
+ */
+
+// words from address up to the end of its page
+static uint32_t page_left(uint16_t address) { 
+    return PAGE_SIZE - (address & (PAGE_SIZE - 1)); 
+}
+
+static uint32_t min32(uint32_t a, uint32_t b) { 
+    return a < b ? a : b; 
+}
+
+static void blockCopy(uint16_t destination, uint16_t source, uint16_t length) { 
+    // destination overlaps the source from above : a forward copy repeats the pattern
+    uint16_t distance = destination - source; 
+    if(distance && distance < length) { 
+        for(uint32_t i = 0; i < length; ++i) { 
+            mem_write(destination + i, mem_read(source + i)); 
+        }
+        return; 
+    }
+    while(length) { 
+        uint32_t run = min32(length, min32(page_left(source), page_left(destination))); 
+        if(page_attributes[source >> PAGE_SHIFT] || page_attributes[destination >> PAGE_SHIFT]) { 
+            for(uint32_t i = 0; i < run; ++i) { 
+                mem_write(destination + i, mem_read(source + i)); 
+            }
+        }else { 
+            memmove(memory + destination, memory + source, run * sizeof(uint16_t)); 
+            dirty_pages[destination >> PAGE_SHIFT] = DIRTY_ALL; 
+        }
+        source += run; 
+        destination += run; 
+        length -= run; 
+    }
+}
+
+static void blockSet(uint16_t destination, uint16_t value, uint16_t length) { 
+    while(length) { 
+        uint32_t run = min32(length, page_left(destination)); 
+        if(page_attributes[destination >> PAGE_SHIFT]) { 
+            for(uint32_t i = 0; i < run; ++i) { 
+                mem_write(destination + i, value); 
+            }
+        }else { 
+            uint16_t* words = memory + destination; 
+            for(uint32_t i = 0; i < run; ++i) { 
+                words[i] = value; 
+            }
+            dirty_pages[destination >> PAGE_SHIFT] = DIRTY_ALL; 
+        }
+        destination += run; 
+        length -= run; 
+    }
+}
+
+static uint16_t blockCompare(uint16_t a, uint16_t b, uint16_t length) { 
+    while(length) { 
+        uint32_t run = min32(length, min32(page_left(a), page_left(b))); 
+        if(page_attributes[a >> PAGE_SHIFT] || page_attributes[b >> PAGE_SHIFT]) { 
+            for(uint32_t i = 0; i < run; ++i) { 
+                uint16_t x = mem_read(a + i), y = mem_read(b + i); 
+                if(x != y) return x < y ? 0xFFFF : 1; 
+            }
+        }else if(memcmp(memory + a, memory + b, run * sizeof(uint16_t))) { 
+            // memcmp only tells that they differ, words are compared as numbers
+            for(uint32_t i = 0; i < run; ++i) { 
+                if(memory[a + i] != memory[b + i]) return memory[a + i] < memory[b + i] ? 0xFFFF : 1; 
+            }
+        }
+        a += run; 
+        b += run; 
+        length -= run; 
+    }
+    return 0; 
+}
+
+void blockOperation(uint16_t instruction) { 
+    /* Instruction format ( see opcodes.h ):
+
+    15          Dest    Src     Len     Op   0
+    |-------------------------------------------|
+    | 1 1 0 1 | D D D | S S S | L L L | O O O   |
+    |-------------------------------------------|
+    */
+    uint16_t r0 = (instruction >> 9) & 0x7; // destination address
+    uint16_t r1 = (instruction >> 6) & 0x7; // source address / fill value
+    uint16_t r2 = (instruction >> 3) & 0x7; // length
+    uint16_t operation = instruction & 0x7; 
+
+    switch(operation) { 
+        case BLK_MEMCPY: 
+            blockCopy(registers[r0], registers[r1], registers[r2]); 
+            break; 
+        case BLK_MEMSET: 
+            blockSet(registers[r0], registers[r1], registers[r2]); 
+            break; 
+        case BLK_MEMCMP: 
+            registers[r0] = blockCompare(registers[r0], registers[r1], registers[r2]); 
+            update_flags(r0); 
+            break; 
+        default: 
+            abort(); 
+    }
 }
 
 // trap functions
@@ -545,10 +672,86 @@ void trapGetC() {
      */
 
     // get a single ASCII char
-    registers[R_R0]  = (uint16_t) getchar(); 
+    registers[R_R0]  = keyboard_getchar(); 
 } 
 
 
+/*
+ * String output for PUTS / PUTSP : plain pages are scanned 8 words at a time for the terminator and
+ * narrowed into a byte buffer, the whole string then goes out with one fwrite(). Pages with attributes
+ * are read word by word through mem_read(). The scan wraps at xFFFF and gives up after one full pass
+ * of the address space ( an unterminated string would otherwise print forever ).
+ */
+#define STRING_VECTOR_WORDS 8
+typedef uint16_t word_vector __attribute__((vector_size(STRING_VECTOR_WORDS * sizeof(uint16_t)))); 
+typedef uint8_t byte_vector __attribute__((vector_size(STRING_VECTOR_WORDS))); 
+
+// two bytes per word for PUTSP
+static char string_buffer[2 * (UINT16_MAX + 1)]; 
+
+// is any word of the vector zero
+static int any_zero(word_vector words) { 
+    word_vector zero = (word_vector)(words == 0); 
+    uint64_t halves[2]; 
+    memcpy(halves, &zero, sizeof(zero)); 
+    return (halves[0] | halves[1]) != 0; 
+}
+
+// append word characters ( one per word ) starting at address, returns 0 once the terminator is found
+static int stringWords(uint16_t* address, uint32_t* remaining, size_t* length) { 
+    uint32_t run = min32(*remaining, page_left(*address)); 
+    uint32_t i = 0; 
+    if(!page_attributes[*address >> PAGE_SHIFT]) { 
+        const uint16_t* words = memory + *address; 
+        for(; i + STRING_VECTOR_WORDS <= run; i += STRING_VECTOR_WORDS) { 
+            word_vector chunk; 
+            memcpy(&chunk, words + i, sizeof(chunk)); 
+            if(any_zero(chunk)) break; 
+            byte_vector narrow = __builtin_convertvector(chunk, byte_vector); 
+            memcpy(string_buffer + *length, &narrow, sizeof(narrow)); 
+            *length += STRING_VECTOR_WORDS; 
+        }
+    }
+    // tail of the page, the vector holding the terminator and device pages
+    for(; i < run; ++i) { 
+        uint16_t character = mem_read(*address + i); 
+        if(!character) return 0; 
+        string_buffer[(*length)++] = (char)character; 
+    }
+    *address += run; 
+    *remaining -= run; 
+    return *remaining != 0; 
+}
+
+// append byte characters ( two per word, low byte first ), returns 0 once the terminator is found
+static int stringBytes(uint16_t* address, uint32_t* remaining, size_t* length) { 
+    uint32_t run = min32(*remaining, page_left(*address)); 
+    uint32_t i = 0; 
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    // host words are already low byte first, vectors with a zero high byte take the slow path
+    if(!page_attributes[*address >> PAGE_SHIFT]) { 
+        const uint16_t* words = memory + *address; 
+        for(; i + STRING_VECTOR_WORDS <= run; i += STRING_VECTOR_WORDS) { 
+            word_vector chunk; 
+            memcpy(&chunk, words + i, sizeof(chunk)); 
+            if(any_zero(chunk >> 8)) break; 
+            memcpy(string_buffer + *length, &chunk, sizeof(chunk)); 
+            *length += sizeof(chunk); 
+        }
+    }
+#endif
+    for(; i < run; ++i) { 
+        uint16_t character = mem_read(*address + i); 
+        if(!character) return 0; 
+        // 8 bits [7:0] ( rightmost ), then [15:8] ( leftmost ) unless it pads an odd length
+        string_buffer[(*length)++] = character & 0xFF; 
+        if(character >> 8) string_buffer[(*length)++] = character >> 8; 
+    }
+    *address += run; 
+    *remaining -= run; 
+    return *remaining != 0; 
+}
+
 void trapPuts(){ 
     /*
      PUTS trap code is used to output a null-terminated string ( similar to printf in C) 
@@ -565,20 +768,22 @@ void trapPuts(){
      */
 
     // one char per word
-    uint16_t* character = memory + registers[R_R0]; 
-    while(*character) { 
-        putc((char)*character, stdout); 
-        ++character;  // increment the memory location  
-    }
+    uint16_t address = registers[R_R0]; 
+    uint32_t remaining = UINT16_MAX + 1; 
+    size_t length = 0; 
+    while(stringWords(&address, &remaining, &length)) ; 
+    fwrite(string_buffer, 1, length, stdout); 
+    output_bytes += length; 
     fflush(stdout);
 }
 
 
-void trapPuts() { 
+void trapOut() { 
     /*
     Write a character in R0[7:0] to the console display.
      */
     putc((char)registers[R_R0], stdout); 
+    ++output_bytes; 
     fflush(stdout);
 }
 
@@ -588,9 +793,10 @@ void trapIn() {
      The character is echoed onto the console monitor, and its ASCII code is copied into R0. 
      The high eight bits of R0 are cleared.
      */ 
-    printf("Enter a character"); 
-    char c = getchar(); 
+    output_bytes += printf("Enter a character"); 
+    char c = keyboard_getchar(); 
     putc(c, stdout); 
+    ++output_bytes; 
     fflush(stdout);
     registers[R_R0]= (uint16_t)c; 
     update_flags(R_R0);
@@ -609,26 +815,20 @@ void trapPutSP() {
      */
 
     //one char per byte ( two bytes ( 16 bit ) per word )
-    uint16_t * character = memory + registers[R_R0]; 
-    while(*character) { 
-
-        // 8 bits [7:0] ( rightmost )
-        char char1 = (*character) & 0xFF ; 
-        putc(char1, stdout);
-
-        // second 8 bits [15:8] (leftmost)
-        char char2 = (*character) >>8 ; 
-        if (char2) putc(char2, stdout);
-        ++character; 
-    }
+    uint16_t address = registers[R_R0]; 
+    uint32_t remaining = UINT16_MAX + 1; 
+    size_t length = 0; 
+    while(stringBytes(&address, &remaining, &length)) ; 
+    fwrite(string_buffer, 1, length, stdout); 
+    output_bytes += length; 
     fflush(stdout);
 }
 
 void trapHalt(){ 
     puts("HALT"); 
     fflush(stdout);
-    running = 0 ; 
-    exit(0); // if you don't want to quite running program comment this line
+    running = 0 ; // the fetch/execute loop stops here
+    halted = 1 ; 
 }
 
 
@@ -659,6 +859,8 @@ void trap(uint16_t instruction) {
     */
 
     uint16_t trapCode  = instruction & 0xFF;   
+    if(perf_counting) ++perf_counters[PERF_TRAPS]; 
+    ++trap_counts[trapCode]; 
     switch(trapCode) { 
         case TRAP_GETC: 
             trapGetC(); 
@@ -5,6 +5,9 @@
 
 #include "./core/opcodes.h"
 
+// OP_RES decodes as a block operation ( lc3 --block-ops )
+int block_ops_enabled; 
+
 void add(uint16_t instruction); 
 void and(uint16_t instruction); 
 void branch(uint16_t instruction); 
@@ -12,12 +15,13 @@ void jump(uint16_t instruction);
 void jumpToSubroutine(uint16_t instruction); 
 void load(uint16_t instruction); 
 void loadIndirect(uint16_t instruction); 
-void loadRegiste(uint16_t instruction); 
+void loadRegister(uint16_t instruction); 
 void loadEffectiveAddress(uint16_t instruction); 
 void not(uint16_t instruction); 
 void store(uint16_t instruction); 
 void storeIndirect(uint16_t instruction); 
 void storeRegister(uint16_t instruction); 
+void blockOperation(uint16_t instruction); 
 void trapGetC(); 
 void trapHalt(); 
 void trapIn(); 
@@ -17,97 +17,309 @@
 #include "./core/core.h"
 #include "./core/input-buffering.h"
 #include "./core/read-image.h"
+#include "./core/image-cache.h"
 #include "./core/input-buffering.h"
+#include "./core/checkpoint.h"
+#include "./core/trace.h"
+#include "./core/profile.h"
+#include "./core/metrics.h"
+#include "./core/compress.h"
+#include "./core/disk.h"
+#include "./core/sampler.h"
+#include "./core/keyboard.h"
+#include "./core/debug.h"
+#include "instruction-set.h"
+#include "execute.h"
+#include "fuzz.h"
+#include "gdb-stub.h"
+#include "lockstep.h"
+#include "hot-trace.h"
+#include "hle.h"
 
+// SIGUSR1 : write the next checkpoint once the current instruction is done
+static const char* checkpoint_prefix; 
+static volatile int checkpoint_requested; 
 
-
-// Standard fetch/execute cycle using switch statement
-void fetchExecute() {
-  /* FETCH */
-  uint16_t instruction = mem_read(registers[R_PC]++);
-  uint16_t opcode = instruction >> 12;
-
-  switch (opcode) {
-  case OP_ADD:
-    add(instruction);      
-    break;
-  case OP_AND:
-    and(instruction);
-    break;
-  case OP_NOT:
-    not(instruction);
-    break;
-  case OP_BR:
-    branch(instruction);
-    break;
-  case OP_JMP:
-    jump(instruction);
-    break;
-  case OP_JSR:
-    jumpToSubroutine(instruction);
-    break;
-  case OP_LD:
-    load(instruction);
-    break;
-  case OP_LDI:
-    loadIndirect(instruction);
-    break;
-  case OP_LDR:
-    loadRegister(instruction);
-    break;
-  case OP_LEA:
-    loadEffectiveAddress(instruction);
-    break;
-  case OP_ST:
-    store(instruction);
-    break;
-  case OP_STI:
-    storeIndirect(instruction);
-    break;
-  case OP_STR:
-    storeRegister(instruction);
-    break;
-  case OP_TRAP:
-    trap(instruction);
-    break;
-  case OP_RES:
-    abort();
-    break;
-  case OP_RTI:
-    abort();
-    break;
-  default:
-    // Bad opcode
-    printf("BAD OPCODE\n");
-    break;
-  }
+void handle_checkpoint(int signal) { 
+    (void) signal; 
+    checkpoint_requested = 1; 
+    running = 0; 
 }
 
-fn main(int argc, const char* argv[]) { 
+int main(int argc, const char* argv[]) { 
     if(argc < 2) { 
-        printf("lc2 [image-file]...\n"); 
+        printf("lc2 [--fuzz=PC] [--checkpoint=PREFIX] [--restore=PREFIX] [--trace=FILE] [--trace-last=N] [--profile=PREFIX] [--record=FILE] [--replay=FILE] [--gdb=PORT] [--gdb-wait] [--batch=LIST] [--block-ops] [--metrics] [--metrics-keep] [--hot-traces] [--compress-idle=MS] [--disk=FILE] [--hle] [--hle-map=FILE] [--hle-verify] [--sample=FILE] [--sample-hz=N] [image-file]...\n"); 
         exit(2); 
     }
 
-    for(int j = 1 ; j < argc, ++j) { 
-        if(!read_image(argv[j], memory)) { 
-            printf("fialed to load image : %s\n", argv[i]); 
+    // --fuzz=PC : persistent fuzzing, snapshot taken when PC ( hex ) is reached
+    int fuzzing = 0; 
+    uint16_t fuzz_mark = 0; 
+    // --restore=PREFIX : resume from the checkpoint chain PREFIX.0, PREFIX.1, ...
+    const char* restore_prefix = NULL; 
+    // --trace=FILE : binary execution trace, --trace-last=N : only keep the last N instructions
+    const char* trace_path = NULL; 
+    uint64_t trace_last = 0; 
+    // --profile=PREFIX : count memory accesses, heatmap and locality reports written at exit
+    const char* profile_prefix = NULL; 
+    // --record=FILE : log when each keyboard character reached the guest, --replay=FILE : feed them back
+    const char* record_path = NULL; 
+    const char* replay_path = NULL; 
+    // --gdb=PORT : accept gdb remote connections while the guest runs
+    int gdb_port = 0; 
+    // --gdb-wait : stay at the first instruction until gdb is connected
+    int gdb_wait = 0; 
+    // --batch=LIST : run the image once per input file named in LIST, many copies in lockstep
+    const char* batch_list = NULL; 
+    int metrics = 0; 
+    // --hot-traces : run hot loops as optimised traces
+    int hot_traces = 0; 
+    const char* disk_path = NULL; 
+    // --sample=FILE : sampling profiler, report rewritten every 10 s and at exit, --sample-hz=N : samples per cpu second
+    const char* sample_path = NULL; 
+    int sample_hz = SAMPLE_DEFAULT_HZ; 
+
+    for(int j = 1 ; j < argc; ++j) { 
+        if(strncmp(argv[j], "--fuzz=", 7) == 0) { 
+            fuzzing = 1; 
+            fuzz_mark = (uint16_t) strtol(argv[j] + 7, NULL, 16); 
+            continue; 
+        }
+        if(strncmp(argv[j], "--checkpoint=", 13) == 0) { 
+            checkpoint_prefix = argv[j] + 13; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--restore=", 10) == 0) { 
+            restore_prefix = argv[j] + 10; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--trace=", 8) == 0) { 
+            trace_path = argv[j] + 8; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--trace-last=", 13) == 0) { 
+            trace_last = strtoull(argv[j] + 13, NULL, 10); 
+            continue; 
+        }
+        if(strncmp(argv[j], "--profile=", 10) == 0) { 
+            profile_prefix = argv[j] + 10; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--record=", 9) == 0) { 
+            record_path = argv[j] + 9; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--replay=", 9) == 0) { 
+            replay_path = argv[j] + 9; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--gdb=", 6) == 0) { 
+            gdb_port = atoi(argv[j] + 6); 
+            continue; 
+        }
+        if(strcmp(argv[j], "--gdb-wait") == 0) { 
+            gdb_wait = 1; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--batch=", 8) == 0) { 
+            batch_list = argv[j] + 8; 
+            continue; 
+        }
+        // --block-ops : decode the reserved opcode as block memory operations
+        if(strcmp(argv[j], "--block-ops") == 0) { 
+            block_ops_enabled = 1; 
+            continue; 
+        }
+        // --metrics : publish live counters in shared memory ( read with src/tools/lc3-metrics.c ), --metrics-keep : leave them there at exit
+        if(strcmp(argv[j], "--metrics") == 0) { 
+            metrics = 1; 
+            continue; 
+        }
+        if(strcmp(argv[j], "--metrics-keep") == 0) { 
+            metrics = 1; 
+            metrics_keep = 1; 
+            continue; 
+        }
+        if(strcmp(argv[j], "--hot-traces") == 0) { 
+            hot_traces = 1; 
+            continue; 
+        }
+        // --compress-idle=MS : compress memory once GETC / IN has waited MS milliseconds for a key
+        if(strncmp(argv[j], "--compress-idle=", 16) == 0) { 
+            compress_idle_ms = atoi(argv[j] + 16); 
+            // nothing waits in the stdio buffer where the idle wait's poll() would miss it
+            setvbuf(stdin, NULL, _IONBF, 0); 
+            continue; 
+        }
+        // --disk=FILE : block storage device backed by FILE ( registers from xFE20, see core/disk.h )
+        if(strncmp(argv[j], "--disk=", 7) == 0) { 
+            disk_path = argv[j] + 7; 
+            continue; 
+        }
+        // --hle : run recognised multiply / divide / shift routines as host code ( see hle.h )
+        if(strcmp(argv[j], "--hle") == 0) { 
+            hle_enabled = 1; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--hle-map=", 10) == 0) { 
+            if(!hle_load_map(argv[j] + 10)) { 
+                printf("failed to load hle map : %s\n", argv[j] + 10); 
+                exit(1); 
+            }
+            hle_enabled = 1; 
+            continue; 
+        }
+        if(strcmp(argv[j], "--hle-verify") == 0) { 
+            hle_enabled = 1; 
+            hle_verify = 1; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--sample=", 9) == 0) { 
+            sample_path = argv[j] + 9; 
+            continue; 
+        }
+        if(strncmp(argv[j], "--sample-hz=", 12) == 0) { 
+            sample_hz = atoi(argv[j] + 12); 
+            continue; 
+        }
+        if(!image_cache_load(argv[j], memory)) { 
+            printf("fialed to load image : %s\n", argv[j]); 
             exit(1); 
         }
+        // idle compression stores pages still equal to the image as a reference to it
+        compress_baseline(image_cache_acquire(argv[j])); 
+        // PROG.sym next to PROG.obj names the addresses of the sampling report
+        sampler_image(argv[j]); 
     }
 
-    signal(SIGINT, handle_interrupt); 
-    disable_input_buffering(); 
-
     // set the program counter to the default address : 0x3000
     // address from 0x0000 to 0x2999 are left empty to leave space for trap routines
     enum { 
-        PC_START : 0x3000
-    };
+        PC_START = 0x3000
+    }; 
     registers[R_PC] = PC_START; 
 
-    // fetch and execute using switch statement
+    if(restore_prefix) { 
+        if(!checkpoint_restore(restore_prefix)) { 
+            printf("failed to restore checkpoint : %s\n", restore_prefix); 
+            exit(1); 
+        }
+        if(!checkpoint_prefix) checkpoint_prefix = restore_prefix; 
+    }
+
+    // after a restore : disk_open() replaces the restored device registers with this run's disk
+    if(disk_path) { 
+        if(!disk_open(disk_path)) { 
+            printf("failed to open disk : %s\n", disk_path); 
+            exit(1); 
+        }
+        atexit(disk_close); 
+    }
+
+    if(batch_list) { 
+        exit(lockstep_batch(batch_list, memory) ? 0 : 1); 
+    }
 
-    fetchExecute(); 
-    restore_input_buffering(); 
+    if(fuzzing) { 
+        fuzz_main(fuzz_mark); // does not return
+    }
+
+    if(trace_path) { 
+        if(!trace_open(trace_path, trace_last)) { 
+            printf("failed to open trace : %s\n", trace_path); 
+            exit(1); 
+        }
+        atexit(trace_close); 
+    }
+
+    if(profile_prefix) { 
+        if(!profile_open(profile_prefix)) { 
+            printf("failed to start profiler : %s\n", profile_prefix); 
+            exit(1); 
+        }
+        atexit(profile_close); 
+    }
+
+    if(record_path) { 
+        if(!keyboard_record(record_path)) { 
+            printf("failed to open recording : %s\n", record_path); 
+            exit(1); 
+        }
+        atexit(keyboard_close); 
+    }
+    if(replay_path && !keyboard_replay(replay_path)) { 
+        printf("failed to read recording : %s\n", replay_path); 
+        exit(1); 
+    }
+
+    if(hle_verify) atexit(hle_report); 
+
+    if(metrics) { 
+        if(!metrics_open()) { 
+            printf("failed to create metrics segment\n"); 
+            exit(1); 
+        }
+        atexit(metrics_close); 
+    }
+
+    if(sample_path) { 
+        if(!sampler_open(sample_path, sample_hz)) { 
+            printf("failed to start sampling profiler : %s\n", sample_path); 
+            exit(1); 
+        }
+        atexit(sampler_close); 
+    }
+
+    signal(SIGINT, handle_interrupt); 
+    if(checkpoint_prefix) signal(SIGUSR1, handle_checkpoint); 
+    if(gdb_port && !gdb_listen(gdb_port, gdb_wait)) { 
+        printf("failed to start gdb stub on port %d\n", gdb_port); 
+        exit(1); 
+    }
+    // the execution trace, the profiler and gdb need every instruction to go through fetchExecute()
+    if(trace_path || profile_prefix || gdb_port) hot_traces = 0; 
+
+    // a replay has no terminal attached
+    if(!replay_path) disable_input_buffering(); 
+
+    // fetch and execute using switch statement
+    while(!halted) { 
+        running = 1; 
+        if(trace_path) { 
+            while(running) { 
+                trace_begin(); 
+                fetchExecute(); 
+                trace_end(); 
+            }
+        }else if(hot_traces) { 
+            hot_run(); 
+        }else if(gdb_attached()) { 
+            while(running) { 
+                debug_begin(); 
+                fetchExecute(); 
+            }
+        }else { 
+            while(running) { 
+                fetchExecute(); 
+            }
+        }
+        if(checkpoint_requested) { 
+            checkpoint_requested = 0; 
+            if(!checkpoint_save(checkpoint_prefix)) { 
+                printf("failed to write checkpoint : %s\n", checkpoint_prefix); 
+            }
+        }
+        if(metrics_requested) { 
+            metrics_requested = 0; 
+            metrics_publish(); 
+        }
+        if(gdb_port) { 
+            gdb_poll(); 
+        }
+        if(debug_stop) { 
+            gdb_stopped(); 
+        }
+    }
+    gdb_exited(); 
+    if(!replay_path) restore_input_buffering(); 
 }
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "./core/core.h"
+#include "./core/opcodes.h"
+#include "./core/bit-utilities.h"
+#include "lockstep.h"
+
+/*
+ * One element per lane. Functions take them by pointer : a 32 byte vector passed or returned
+ * by value has a different ABI with and without -mavx2 ( -Wpsabi ).
+ */
+typedef uint16_t lane_vector __attribute__((vector_size(LOCKSTEP_LANES * sizeof(uint16_t)))); 
+// result of a lane wise compare : all ones or all zeros
+typedef int16_t lane_mask __attribute__((vector_size(LOCKSTEP_LANES * sizeof(uint16_t)))); 
+
+static lane_vector lane_registers[R_COUNT]; 
+static uint16_t lane_memory[LOCKSTEP_LANES][PAGE_COUNT * PAGE_SIZE]; 
+// pages some lane has stored to : only there can lanes hold different code
+static uint8_t written_pages[PAGE_COUNT]; 
+static lane_mask live; 
+static struct lockstep_lane* lanes; 
+
+// a where mask is set, b elsewhere ( b is evaluated twice )
+#define BLEND(mask, a, b) ((((a) ^ (b)) & (lane_vector) (mask)) ^ (b))
+#define SPLAT(value) ((lane_vector) { 0 } + (uint16_t) (value))
+
+static void stop_lane(int lane, int state) { 
+    lanes[lane].state = state; 
+    live[lane] = 0; 
+}
+
+static void lane_output(int lane, char c) { 
+    struct lockstep_lane* l = &lanes[lane]; 
+    if(l->output_size == l->output_capacity) { 
+        l->output_capacity = l->output_capacity ? l->output_capacity * 2 : 256; 
+        l->output = realloc(l->output, l->output_capacity); 
+    }
+    l->output[l->output_size++] = c; 
+}
+
+// next input character, the lane stops when there is none left
+static uint16_t lane_getchar(int lane) { 
+    struct lockstep_lane* l = &lanes[lane]; 
+    if(l->input_pos == l->input_size) { 
+        stop_lane(lane, LANE_STOPPED); 
+        return (uint16_t) EOF; 
+    }
+    return l->input[l->input_pos++]; 
+}
+
+// same keyboard device semantics as mem_read()
+static uint16_t lane_read(int lane, uint16_t address) { 
+    uint16_t* memory = lane_memory[lane]; 
+    if(address == MR_KBSR) { 
+        struct lockstep_lane* l = &lanes[lane]; 
+        if(l->input_pos < l->input_size) { 
+            memory[MR_KBSR] = 1 << 15; 
+            memory[MR_KBDR] = l->input[l->input_pos++]; 
+        }else { 
+            memory[MR_KBSR] = 0; 
+            stop_lane(lane, LANE_STOPPED); 
+        }
+    }
+    return memory[address]; 
+}
+
+// value = the words at address, lanes outside mask get 0
+static void gather(lane_vector* value, const lane_mask* mask, const lane_vector* address) { 
+    // copies : lane_read() stops lanes by writing live, which mask may point to
+    lane_mask m = *mask; 
+    lane_vector a = *address, result = { 0 }; 
+    for(int lane = 0; lane < LOCKSTEP_LANES; ++lane) { 
+        if(m[lane]) result[lane] = lane_read(lane, a[lane]); 
+    }
+    *value = result; 
+}
+
+static void scatter(const lane_mask* mask, const lane_vector* address, const lane_vector* value) { 
+    lane_mask m = *mask; 
+    lane_vector a = *address, v = *value; 
+    for(int lane = 0; lane < LOCKSTEP_LANES; ++lane) { 
+        if(m[lane]) { 
+            lane_memory[lane][a[lane]] = v[lane]; 
+            written_pages[a[lane] >> PAGE_SHIFT] = 1; 
+        }
+    }
+}
+
+// write a register and set the condition flags from it
+static void set_register(const lane_mask* mask, uint16_t r, const lane_vector* value) { 
+    lane_mask m = *mask; 
+    lane_vector v = *value; 
+    lane_vector zero = (lane_vector) (v == 0); 
+    lane_vector negative = (lane_vector) ((lane_mask) v < 0); 
+    lane_vector flags = (zero & FL_ZRO) | (negative & FL_NEG) | (~zero & ~negative & FL_POS); 
+    lane_registers[r] = BLEND(m, v, lane_registers[r]); 
+    lane_registers[R_COND] = BLEND(m, flags, lane_registers[R_COND]); 
+}
+
+static void lane_trap(int lane, uint16_t trap_code) { 
+    uint16_t* memory = lane_memory[lane]; 
+    switch(trap_code) { 
+    case TRAP_GETC: 
+        lane_registers[R_R0][lane] = lane_getchar(lane); 
+        break; 
+    case TRAP_OUT: 
+        lane_output(lane, (char) lane_registers[R_R0][lane]); 
+        break; 
+    case TRAP_PUTS: 
+        for(uint16_t address = lane_registers[R_R0][lane]; memory[address]; ++address) { 
+            lane_output(lane, (char) memory[address]); 
+        }
+        break; 
+    case TRAP_IN: { 
+        const char* prompt = "Enter a character"; 
+        while(*prompt) lane_output(lane, *prompt++); 
+        char c = lane_getchar(lane); 
+        lane_output(lane, c); 
+        lane_registers[R_R0][lane] = (uint16_t) c; 
+        lane_mask one = { 0 }; 
+        one[lane] = -1; 
+        set_register(&one, R_R0, &lane_registers[R_R0]); 
+        break; 
+    }
+    case TRAP_PUTSP: 
+        for(uint16_t address = lane_registers[R_R0][lane]; memory[address]; ++address) { 
+            lane_output(lane, (char) (memory[address] & 0xFF)); 
+            if(memory[address] >> 8) lane_output(lane, (char) (memory[address] >> 8)); 
+        }
+        break; 
+    case TRAP_HALT: 
+        stop_lane(lane, LANE_HALTED); 
+        break; 
+    }
+}
+
+// execute one instruction in every lane of mask ( they all fetched this instruction )
+static void step(const lane_mask* lanes_to_step, uint16_t instruction) { 
+    lane_mask mask = *lanes_to_step; 
+    uint16_t dr = (instruction >> 9) & 0x7; 
+    uint16_t sr1 = (instruction >> 6) & 0x7; 
+    lane_vector pc = lane_registers[R_PC] + 1; 
+    lane_vector address, value; 
+    lane_registers[R_PC] = BLEND(mask, pc, lane_registers[R_PC]); 
+
+    switch(instruction >> 12) { 
+    case OP_ADD: { 
+        lane_vector operand = instruction & 0x20 ? SPLAT(sign_extend(instruction & 0x1F, 5)) : lane_registers[instruction & 0x7]; 
+        value = lane_registers[sr1] + operand; 
+        set_register(&mask, dr, &value); 
+        break; 
+    }
+    case OP_AND: { 
+        lane_vector operand = instruction & 0x20 ? SPLAT(sign_extend(instruction & 0x1F, 5)) : lane_registers[instruction & 0x7]; 
+        value = lane_registers[sr1] & operand; 
+        set_register(&mask, dr, &value); 
+        break; 
+    }
+    case OP_NOT: 
+        value = ~lane_registers[sr1]; 
+        set_register(&mask, dr, &value); 
+        break; 
+    case OP_BR: { 
+        lane_mask taken = mask & ((lane_registers[R_COND] & dr) != 0); 
+        lane_registers[R_PC] = BLEND(taken, pc + sign_extend(instruction & 0x1FF, 9), lane_registers[R_PC]); 
+        break; 
+    }
+    case OP_JMP: 
+        lane_registers[R_PC] = BLEND(mask, lane_registers[sr1], lane_registers[R_PC]); 
+        break; 
+    case OP_JSR: { 
+        lane_vector target = instruction & 0x800 ? pc + sign_extend(instruction & 0x7FF, 11) : lane_registers[sr1]; 
+        lane_registers[R_R7] = BLEND(mask, pc, lane_registers[R_R7]); 
+        lane_registers[R_PC] = BLEND(mask, target, lane_registers[R_PC]); 
+        break; 
+    }
+    case OP_LD: 
+        address = pc + sign_extend(instruction & 0x1FF, 9); 
+        gather(&value, &mask, &address); 
+        set_register(&mask, dr, &value); 
+        break; 
+    case OP_LDI: 
+        address = pc + sign_extend(instruction & 0x1FF, 9); 
+        gather(&address, &mask, &address); 
+        gather(&value, &mask, &address); 
+        set_register(&mask, dr, &value); 
+        break; 
+    case OP_LDR: 
+        address = lane_registers[sr1] + sign_extend(instruction & 0x3F, 6); 
+        gather(&value, &mask, &address); 
+        set_register(&mask, dr, &value); 
+        break; 
+    case OP_LEA: 
+        value = pc + sign_extend(instruction & 0x1FF, 9); 
+        set_register(&mask, dr, &value); 
+        break; 
+    case OP_ST: 
+        address = pc + sign_extend(instruction & 0x1FF, 9); 
+        scatter(&mask, &address, &lane_registers[dr]); 
+        break; 
+    case OP_STI: 
+        address = pc + sign_extend(instruction & 0x1FF, 9); 
+        gather(&address, &mask, &address); 
+        scatter(&mask, &address, &lane_registers[dr]); 
+        break; 
+    case OP_STR: 
+        address = lane_registers[sr1] + sign_extend(instruction & 0x3F, 6); 
+        scatter(&mask, &address, &lane_registers[dr]); 
+        break; 
+    case OP_TRAP: 
+        for(int lane = 0; lane < LOCKSTEP_LANES; ++lane) { 
+            if(mask[lane]) lane_trap(lane, instruction & 0xFF); 
+        }
+        break; 
+    default: 
+        // RTI, reserved
+        for(int lane = 0; lane < LOCKSTEP_LANES; ++lane) { 
+            if(mask[lane]) stop_lane(lane, LANE_FAULTED); 
+        }
+        break; 
+    }
+}
+
+// is any lane of mask set
+static int any(const lane_mask* mask) { 
+    uint64_t words[sizeof(*mask) / sizeof(uint64_t)]; 
+    memcpy(words, mask, sizeof(*mask)); 
+    uint64_t bits = 0; 
+    for(size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i) bits |= words[i]; 
+    return bits != 0; 
+}
+
+static int count(const lane_mask* mask) { 
+    int n = 0; 
+    for(int lane = 0; lane < LOCKSTEP_LANES; ++lane) n += (*mask)[lane] != 0; 
+    return n; 
+}
+
+// run a single lane on its own for up to LOCKSTEP_BURST instructions
+static uint64_t burst(int lane) { 
+    lane_mask mask = { 0 }; 
+    mask[lane] = -1; 
+    uint64_t n = 0; 
+    while(n < LOCKSTEP_BURST && live[lane]) { 
+        step(&mask, lane_memory[lane][lane_registers[R_PC][lane]]); 
+        ++n; 
+    }
+    return n; 
+}
+
+/*
+ * Run lane_count copies of image until every lane halted, faulted or stopped,
+ * or budget steps went by. Returns the number of instructions executed over all lanes.
+ */
+uint64_t lockstep_run(const uint16_t image[], struct lockstep_lane lane_state[], int lane_count, uint64_t budget) { 
+    lanes = lane_state; 
+    for(int r = 0; r < R_COUNT; ++r) lane_registers[r] = SPLAT(0); 
+    lane_registers[R_PC] = SPLAT(0x3000); 
+    for(int lane = 0; lane < LOCKSTEP_LANES; ++lane) { 
+        live[lane] = lane < lane_count ? -1 : 0; 
+        if(lane < lane_count) { 
+            memcpy(lane_memory[lane], image, sizeof(lane_memory[lane])); 
+            lanes[lane].state = LANE_RUNNING; 
+        }
+    }
+
+    memset(written_pages, 0, sizeof(written_pages)); 
+
+    uint64_t instructions = 0; 
+    int live_count = lane_count; 
+    int first = 0; // a live lane
+    int diverged = 0; 
+    for(uint64_t steps = 0; steps < budget && live_count; ++steps) { 
+        if(!live[first]) { 
+            for(first = 0; !live[first]; ++first); 
+        }
+        uint16_t pc = lane_registers[R_PC][first]; 
+        lane_mask mask = live & (lane_registers[R_PC] == pc); 
+        int group = live_count; 
+
+        lane_mask differ = mask ^ live; 
+        if(any(&differ)) { 
+            // diverged : lanes at the lowest PC go next
+            lane_vector pcs = BLEND(live, lane_registers[R_PC], SPLAT(0xFFFF)); 
+            for(int lane = 0; lane < LOCKSTEP_LANES; ++lane) { 
+                if(pcs[lane] < pc) pc = pcs[lane]; 
+            }
+            mask = live & (pcs == pc); 
+            group = count(&mask); 
+        }
+
+        // guests may have rewritten their code differently
+        int leader = first; 
+        if(!mask[leader]) { 
+            for(leader = 0; !mask[leader]; ++leader); 
+        }
+        uint16_t instruction = lane_memory[leader][pc]; 
+        if(written_pages[pc >> PAGE_SHIFT]) { 
+            for(int lane = 0; lane < LOCKSTEP_LANES; ++lane) { 
+                if(mask[lane] && lane_memory[lane][pc] != instruction) { 
+                    mask[lane] = 0; 
+                    --group; 
+                }
+            }
+        }
+
+        step(&mask, instruction); 
+        instructions += group; 
+
+        // too little sharing : give every lane a burst on its own
+        if(group < LOCKSTEP_LANES / 4 && group < live_count) { 
+            if(++diverged == LOCKSTEP_DIVERGED_STEPS) { 
+                for(int lane = 0; lane < LOCKSTEP_LANES; ++lane) { 
+                    if(live[lane]) instructions += burst(lane); 
+                }
+                diverged = 0; 
+            }
+        }else { 
+            diverged = 0; 
+        }
+        // step() halts lanes of mask, a burst any live lane
+        live_count = count(&live); 
+    }
+
+    for(int lane = 0; lane < lane_count; ++lane) { 
+        if(live[lane]) stop_lane(lane, LANE_STOPPED); 
+    }
+    return instructions; 
+}
+
+static uint8_t* read_file(const char* path, size_t* size) { 
+    FILE* file = fopen(path, "rb"); 
+    if(!file) return NULL; 
+    fseek(file, 0, SEEK_END); 
+    long length = ftell(file); 
+    fseek(file, 0, SEEK_SET); 
+    uint8_t* data = malloc(length + 1); 
+    *size = fread(data, 1, length, file); 
+    fclose(file); 
+    return data; 
+}
+
+/*
+ * Batch mode : list_path names one input file per line.
+ * Each input runs in its own lane, the output is written to INPUT.out
+ */
+int lockstep_batch(const char* list_path, const uint16_t image[]) { 
+    FILE* list = fopen(list_path, "r"); 
+    if(!list) return 0; 
+
+    enum { BATCH_BUDGET = 1 << 30 }; 
+    static char paths[LOCKSTEP_LANES][4096]; 
+    struct lockstep_lane lane_state[LOCKSTEP_LANES]; 
+    uint64_t instructions = 0; 
+    int runs = 0; 
+    struct timespec start, end; 
+    clock_gettime(CLOCK_MONOTONIC, &start); 
+
+    int done = 0; 
+    while(!done) { 
+        int lane_count = 0; 
+        while(lane_count < LOCKSTEP_LANES && fgets(paths[lane_count], sizeof(paths[0]), list)) { 
+            paths[lane_count][strcspn(paths[lane_count], "\r\n")] = 0; 
+            if(!paths[lane_count][0]) continue; 
+            memset(&lane_state[lane_count], 0, sizeof(lane_state[0])); 
+            lane_state[lane_count].input = read_file(paths[lane_count], &lane_state[lane_count].input_size); 
+            if(!lane_state[lane_count].input) { 
+                printf("failed to read input : %s\n", paths[lane_count]); 
+                continue; 
+            }
+            ++lane_count; 
+        }
+        if(lane_count < LOCKSTEP_LANES) done = 1; 
+        if(!lane_count) break; 
+
+        instructions += lockstep_run(image, lane_state, lane_count, BATCH_BUDGET); 
+
+        for(int lane = 0; lane < lane_count; ++lane) { 
+            char out_path[sizeof(paths[0]) + sizeof(".out")]; 
+            FILE* out = NULL; 
+            if(snprintf(out_path, sizeof(out_path), "%s.out", paths[lane]) < (int) sizeof(out_path)) out = fopen(out_path, "wb"); 
+            if(out) { 
+                fwrite(lane_state[lane].output, 1, lane_state[lane].output_size, out); 
+                fclose(out); 
+            }
+            if(lane_state[lane].state == LANE_FAULTED) printf("%s : bad opcode\n", paths[lane]); 
+            free((void*) lane_state[lane].input); 
+            free(lane_state[lane].output); 
+            ++runs; 
+        }
+    }
+    fclose(list); 
+
+    clock_gettime(CLOCK_MONOTONIC, &end); 
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9; 
+    printf("%d runs, %llu instructions, %.3f s, %.1f MIPS\n", runs, (unsigned long long) instructions, 
+            seconds, seconds > 0 ? instructions / seconds * 1e-6 : 0.0); 
+    return 1; 
+}
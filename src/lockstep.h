@@ -0,0 +1,42 @@
+#ifndef _LOCKSTEP
+#define _LOCKSTEP
+
+#include<stdint.h> 
+#include<stddef.h> 
+
+/*
+ * Lockstep engine : up to LOCKSTEP_LANES copies of one image, each with its own
+ * memory, registers and keyboard input, executed together one vector lane per machine.
+ *
+ * Every step runs the lanes that sit at the lowest PC ( so lanes that took different
+ * paths wait for each other and reconverge ), the others are masked off.
+ * When too few lanes share a PC for too long, lanes run one at a time in bursts instead.
+ */
+enum { 
+    LOCKSTEP_LANES          = 16,   // 16 x 16 bit = one AVX2 register
+    LOCKSTEP_DIVERGED_STEPS = 64,   // steps with a small group before bursting
+    LOCKSTEP_BURST          = 1024, // instructions per lane and burst
+};
+
+// lane state
+enum { 
+    LANE_RUNNING = 0, 
+    LANE_HALTED,    // HALT
+    LANE_FAULTED,   // RTI / reserved opcode
+    LANE_STOPPED,   // waited for input that never comes, or ran out of budget
+};
+
+struct lockstep_lane { 
+    const uint8_t* input;   // keyboard input
+    size_t input_size; 
+    size_t input_pos; 
+    char* output;           // everything the lane printed ( malloc'd )
+    size_t output_size; 
+    size_t output_capacity; 
+    int state; 
+};
+
+uint64_t lockstep_run(const uint16_t image[], struct lockstep_lane lanes[], int lane_count, uint64_t budget); 
+int lockstep_batch(const char* list_path, const uint16_t image[]); 
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * VM pool test : a context never sees memory another context wrote.
+ *
+ * A writes memory and is dropped without vm_context_save(), then B is loaded : B must
+ * read zeros there. The same after a context is freed, saved or not, and its slot is
+ * handed out again.
+ * Prints what failed, exit status 0 when everything passed.
+ *
+ * build : cc -O2 -fcommon -o vm-pool-test tests/vm-pool-test.c instruction-set.c execute.c fuzz.c hot-trace.c hle.c core/[a-z]*.c -lm -lpthread -lrt
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../core/core.h"
+#include "../core/vm-pool.h"
+
+static int failures; 
+
+static void expect_zero(const char* what, uint16_t address) { 
+    uint16_t value = mem_read(address); 
+    if(value == 0) return; 
+    printf("FAIL %s : x%04X holds x%04X\n", what, address, value); 
+    ++failures; 
+}
+
+int main() { 
+    struct vm_pool pool; 
+    if(!vm_pool_create(&pool, 4)) { 
+        printf("FAIL vm_pool_create\n"); 
+        return 1; 
+    }
+
+    // dropped without a save
+    struct vm_context* a = vm_alloc(&pool); 
+    struct vm_context* b = vm_alloc(&pool); 
+    vm_context_load(a); 
+    mem_write(0x3000, 0x1234); 
+    mem_write(0x8000, 0x5678); 
+    vm_context_load(b); 
+    expect_zero("unsaved A, then B", 0x3000); 
+    expect_zero("unsaved A, then B", 0x8000); 
+
+    // saved, freed, slot handed out again
+    vm_context_load(a); 
+    mem_write(0x4000, 0x9ABC); 
+    vm_context_save(a); 
+    vm_free(&pool, a); 
+    struct vm_context* c = vm_alloc(&pool); 
+    if(c != a) printf("note : the freed slot was not reused\n"); 
+    vm_context_load(c); 
+    expect_zero("A freed, slot reused by C", 0x4000); 
+    expect_zero("A freed, slot reused by C", 0x3000); 
+
+    // B saved what it wrote and gets it back after another context ran
+    vm_context_load(b); 
+    mem_write(0x5000, 0x0042); 
+    vm_context_save(b); 
+    vm_context_load(c); 
+    expect_zero("B saved, then C", 0x5000); 
+    vm_context_load(b); 
+    if(mem_read(0x5000) != 0x0042) { 
+        printf("FAIL B reloaded : x5000 holds x%04X\n", mem_read(0x5000)); 
+        ++failures; 
+    }
+
+    // freed while still loaded, without a save, slot handed out again
+    vm_context_load(c); 
+    mem_write(0x6000, 0x7777); 
+    vm_free(&pool, c); 
+    struct vm_context* d = vm_alloc(&pool); 
+    vm_context_load(d); 
+    expect_zero("C freed while loaded, slot reused by D", 0x6000); 
+
+    vm_free(&pool, b); 
+    vm_free(&pool, d); 
+    vm_pool_destroy(&pool); 
+    printf("%s\n", failures ? "FAILED" : "ok"); 
+    return failures ? 1 : 0; 
+}
@@ -0,0 +1,161 @@
+/*
+ * Show the live metrics of every lc3 started with --metrics
+ *
+ * lc3-metrics [--watch=SECONDS] [--remove-stale]
+ *   --watch         redraw every SECONDS
+ *   --remove-stale  unlink segments left behind by processes that are gone ( lc3 --metrics-keep )
+ *
+ * The last line adds up all live processes.
+ *
+ * build : cc -O2 -fcommon -o lc3-metrics tools/lc3-metrics.c -lrt
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#include "../core/metrics.h"
+#include "../core/opcodes.h"
+
+#define SEGMENT_PREFIX "lc3-metrics."
+
+static uint64_t monotonic_ns() { 
+    struct timespec now; 
+    clock_gettime(CLOCK_MONOTONIC, &now); 
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec; 
+}
+
+// consistent copy of a segment, 0 when it is not a metrics segment
+static int read_segment(const char* name, struct metrics_page* copy, uint64_t* input_wait_ns) { 
+    char path[300]; 
+    snprintf(path, sizeof(path), "/%s", name); 
+    int fd = shm_open(path, O_RDONLY, 0); 
+    if(fd < 0) return 0; 
+    const struct metrics_page* page = mmap(NULL, sizeof(*page), PROT_READ, MAP_SHARED, fd, 0); 
+    close(fd); 
+    if(page == MAP_FAILED) return 0; 
+
+    int ok = 0; 
+    for(int attempt = 0; attempt < 1000; ++attempt) { 
+        uint32_t before = atomic_load_explicit((_Atomic uint32_t*) &page->sequence, memory_order_acquire); 
+        if(before & 1) continue; 
+        memcpy(copy, (const void*) page, sizeof(*copy)); 
+        atomic_thread_fence(memory_order_acquire); 
+        if(atomic_load_explicit((_Atomic uint32_t*) &page->sequence, memory_order_relaxed) == before) { 
+            ok = 1; 
+            break; 
+        }
+    }
+    *input_wait_ns = atomic_load_explicit((_Atomic uint64_t*) &page->input_wait_ns, memory_order_relaxed); 
+    munmap((void*) page, sizeof(*page)); 
+    return ok && copy->magic == METRICS_MAGIC && copy->version == METRICS_VERSION; 
+}
+
+static const char* state_name(const struct metrics_page* page, uint64_t input_wait_ns, int alive) { 
+    // a VM that ran to HALT leaves its segment behind
+    if(page->state == METRICS_HALTED) return "halted"; 
+    if(!alive) return "gone"; 
+    if(input_wait_ns) return "input"; 
+    // an empty KBSR poll at least every 8 instructions
+    if(page->polls_per_second && page->polls_per_second * 8 >= page->instructions_per_second) return "polling"; 
+    return "running"; 
+}
+
+static void show(int remove_stale) { 
+    DIR* directory = opendir("/dev/shm"); 
+    if(!directory) { 
+        perror("/dev/shm"); 
+        exit(1); 
+    }
+    printf("%8s %-8s %6s %14s %12s %10s %10s %10s %12s %8s\n", 
+        "pid", "state", "pc", "instructions", "ips", "output", "polls/s", "blocked", "traps", "age"); 
+
+    struct metrics_page total; 
+    memset(&total, 0, sizeof(total)); 
+    int processes = 0; 
+    uint64_t now = monotonic_ns(); 
+    struct dirent* entry; 
+    while((entry = readdir(directory))) { 
+        if(strncmp(entry->d_name, SEGMENT_PREFIX, strlen(SEGMENT_PREFIX)) != 0) continue; 
+        struct metrics_page page; 
+        uint64_t input_wait_ns; 
+        if(!read_segment(entry->d_name, &page, &input_wait_ns)) continue; 
+        int alive = kill(page.pid, 0) == 0 || errno == EPERM; 
+        if(!alive && remove_stale) { 
+            char path[300]; 
+            snprintf(path, sizeof(path), "/%s", entry->d_name); 
+            shm_unlink(path); 
+            continue; 
+        }
+
+        uint64_t traps = 0; 
+        for(int vector = 0; vector <= UINT8_MAX; ++vector) traps += page.traps[vector]; 
+        // time blocked so far includes a wait still in progress
+        uint64_t blocked = page.input_blocked_ns + (input_wait_ns ? now - input_wait_ns : 0); 
+        printf("%8d %-8s  x%04X %14llu %12llu %10llu %10llu %9.1fs %12llu %7.1fs\n", 
+            page.pid, state_name(&page, input_wait_ns, alive), page.pc, 
+            (unsigned long long) page.instructions_retired, 
+            (unsigned long long) page.instructions_per_second, 
+            (unsigned long long) page.output_bytes, 
+            (unsigned long long) page.polls_per_second, 
+            blocked / 1e9, 
+            (unsigned long long) traps, 
+            (now - page.updated_ns) / 1e9); 
+        if(!alive) continue; 
+
+        ++processes; 
+        total.instructions_retired += page.instructions_retired; 
+        total.instructions_per_second += page.instructions_per_second; 
+        total.output_bytes += page.output_bytes; 
+        total.polls_per_second += page.polls_per_second; 
+        total.input_blocked_ns += blocked; 
+        for(int vector = 0; vector <= UINT8_MAX; ++vector) total.traps[vector] += page.traps[vector]; 
+    }
+    closedir(directory); 
+
+    uint64_t traps = 0; 
+    for(int vector = 0; vector <= UINT8_MAX; ++vector) traps += total.traps[vector]; 
+    printf("%8s %-8d %6s %14llu %12llu %10llu %10llu %9.1fs %12llu\n", 
+        "total", processes, "", 
+        (unsigned long long) total.instructions_retired, 
+        (unsigned long long) total.instructions_per_second, 
+        (unsigned long long) total.output_bytes, 
+        (unsigned long long) total.polls_per_second, 
+        total.input_blocked_ns / 1e9, 
+        (unsigned long long) traps); 
+    printf("traps : GETC %llu  OUT %llu  PUTS %llu  IN %llu  PUTSP %llu  HALT %llu\n", 
+        (unsigned long long) total.traps[TRAP_GETC], (unsigned long long) total.traps[TRAP_OUT], 
+        (unsigned long long) total.traps[TRAP_PUTS], (unsigned long long) total.traps[TRAP_IN], 
+        (unsigned long long) total.traps[TRAP_PUTSP], (unsigned long long) total.traps[TRAP_HALT]); 
+}
+
+int main(int argc, const char* argv[]) { 
+    double watch = 0; 
+    int remove_stale = 0; 
+    for(int j = 1; j < argc; ++j) { 
+        if(strncmp(argv[j], "--watch=", 8) == 0) { 
+            watch = atof(argv[j] + 8); 
+        }else if(strcmp(argv[j], "--remove-stale") == 0) { 
+            remove_stale = 1; 
+        }else { 
+            printf("lc3-metrics [--watch=SECONDS] [--remove-stale]\n"); 
+            return 2; 
+        }
+    }
+    while(1) { 
+        if(watch > 0) printf("\033[H\033[J"); 
+        show(remove_stale); 
+        if(watch <= 0) break; 
+        fflush(stdout); 
+        usleep((useconds_t) (watch * 1e6)); 
+    }
+    return 0; 
+}
@@ -0,0 +1,106 @@
+/*
+ * Decode and filter an execution trace written by lc3 --trace=FILE
+ *
+ * trace-decode FILE [--pc=LO-HI] [--op=NAME] [--addr=ADDRESS] [--last=N]
+ *   --pc    only instructions with LO <= PC <= HI ( hex )
+ *   --op    only one opcode ( BR, ADD, LD, ... )
+ *   --addr  only instructions that loaded or stored ADDRESS ( hex )
+ *   --last  only the last N records
+ *
+ * build : cc -O2 -fcommon -o trace-decode tools/trace-decode.c
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../core/trace.h"
+
+// indexed by instruction >> 12
+static const char* opcode_names[16] = { 
+    "BR", "ADD", "LD", "ST", "JSR", "AND", "LDR", "STR", 
+    "RTI", "NOT", "LDI", "STI", "JMP", "RES", "LEA", "TRAP", 
+};
+
+int main(int argc, const char* argv[]) { 
+    if(argc < 2) { 
+        printf("trace-decode FILE [--pc=LO-HI] [--op=NAME] [--addr=ADDRESS] [--last=N]\n"); 
+        exit(2); 
+    }
+
+    unsigned pc_low = 0, pc_high = 0xFFFF; 
+    int opcode = -1; 
+    long address = -1; 
+    uint64_t last = 0; 
+    for(int j = 2; j < argc; ++j) { 
+        if(strncmp(argv[j], "--pc=", 5) == 0) { 
+            if(sscanf(argv[j] + 5, "%x-%x", &pc_low, &pc_high) != 2) pc_high = pc_low; 
+        }else if(strncmp(argv[j], "--op=", 5) == 0) { 
+            for(int op = 0; op < 16; ++op) { 
+                if(strcasecmp(argv[j] + 5, opcode_names[op]) == 0) opcode = op; 
+            }
+            if(opcode < 0) { 
+                printf("unknown opcode : %s\n", argv[j] + 5); 
+                exit(2); 
+            }
+        }else if(strncmp(argv[j], "--addr=", 7) == 0) { 
+            address = strtol(argv[j] + 7, NULL, 16); 
+        }else if(strncmp(argv[j], "--last=", 7) == 0) { 
+            last = strtoull(argv[j] + 7, NULL, 10); 
+        }else { 
+            printf("unknown option : %s\n", argv[j]); 
+            exit(2); 
+        }
+    }
+
+    int fd = open(argv[1], O_RDONLY); 
+    struct stat st; 
+    if(fd < 0 || fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(struct trace_header)) { 
+        printf("failed to open trace : %s\n", argv[1]); 
+        exit(1); 
+    }
+    const struct trace_header* header = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0); 
+    if(header == MAP_FAILED || header->magic != TRACE_MAGIC || header->version != TRACE_VERSION 
+            || header->record_size != sizeof(struct trace_record)) { 
+        printf("not a trace file : %s\n", argv[1]); 
+        exit(1); 
+    }
+    const struct trace_record* records = (const struct trace_record*) (header + 1); 
+    uint64_t stored = (st.st_size - sizeof(*header)) / sizeof(struct trace_record); 
+
+    // oldest record still in the file
+    uint64_t first = 0; 
+    if(header->capacity && header->count > header->capacity) first = header->count - header->capacity; 
+    if(header->count > stored + first) { 
+        printf("trace is truncated\n"); 
+        exit(1); 
+    }
+    if(last && header->count - first > last) first = header->count - last; 
+
+    for(uint64_t n = first; n < header->count; ++n) { 
+        const struct trace_record* r = &records[header->capacity ? n % header->capacity : n]; 
+        int op = r->instruction >> 12; 
+        if(r->pc < pc_low || r->pc > pc_high) continue; 
+        if(opcode >= 0 && op != opcode) continue; 
+        if(address >= 0 && (!(r->flags & (TRACE_LOAD | TRACE_STORE)) || r->address != address)) continue; 
+
+        printf("%10llu  %04x  %04x  %-4s", (unsigned long long) n, r->pc, r->instruction, opcode_names[op]); 
+        if(r->flags & TRACE_DEST) { 
+            printf("  dest=%04x", r->dest); 
+        }
+        if(r->flags & TRACE_LOAD) { 
+            printf("  load [%04x]=%04x", r->address, r->value); 
+        }
+        if(r->flags & TRACE_STORE) { 
+            printf("  store [%04x]=%04x", r->address, r->value); 
+        }
+        printf("\n"); 
+    }
+    return 0; 
+}